@@ -23,6 +23,8 @@
 #define __MTRACKD_GLOBAL__
 
 #include <stdio.h>
+#include <time.h>
+#include "log.h"
 
 #define LOG_NONE 0
 #define LOG_INFO 1
@@ -30,10 +32,19 @@
 
 extern int log_level;
 
-#define INFO(...)  { if (log_level >= LOG_INFO)  { fprintf(stderr, "[I] "); fprintf(stderr, __VA_ARGS__); } }
-#define WARN(...)  { if (log_level >= LOG_INFO)  { fprintf(stderr, "[W] "); fprintf(stderr, __VA_ARGS__); } }
-#define ERROR(...) { if (log_level >= LOG_INFO)  { fprintf(stderr, "[E] "); fprintf(stderr, __VA_ARGS__); } }
-#define DEBUG(...) { if (log_level >= LOG_DEBUG) { fprintf(stderr, "[D] "); fprintf(stderr, __VA_ARGS__); } }
+#define INFO(...)  { if (log_level >= LOG_INFO)  { log_printf("[I] ", __VA_ARGS__); } }
+#define WARN(...)  { if (log_level >= LOG_INFO)  { log_printf("[W] ", __VA_ARGS__); } }
+#define ERROR(...) { if (log_level >= LOG_INFO)  { log_printf("[E] ", __VA_ARGS__); } }
+#define DEBUG(...) { if (log_level >= LOG_DEBUG) { log_printf("[D] ", __VA_ARGS__); } }
+
+/* Seconds on the monotonic clock. All deadlines are measured on this clock so
+ * that wall clock steps do not affect them.
+ */
+static inline double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
 
 #endif
 
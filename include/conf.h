@@ -26,25 +26,82 @@
 #include <stdint.h>
 
 #define MTRACKD_DEFAULT_CONF ".dispad"
+#define MTRACKD_DEFAULT_CACHE_FILE ".dispad.cache"
 #define MTRACKD_DEFAULT_PROP "Trackpad Disable Input"
 #define MTRACKD_DEFAULT_ENABLE 0
 #define MTRACKD_DEFAULT_DISABLE 1
 #define MTRACKD_DEFAULT_MODIFIERS False
+#define MTRACKD_DEFAULT_PROFILES True
+#define MTRACKD_DEFAULT_BACKEND "auto"
+#define MTRACKD_DEFAULT_MECHANISM "property"
+#define MTRACKD_DEFAULT_CONTROL_THREAD True
+#define MTRACKD_DEFAULT_DISPLAYS NULL
 #define MTRACKD_DEFAULT_POLL 100
+#define MTRACKD_DEFAULT_POLL_MAX 500
+#define MTRACKD_DEFAULT_POLL_BATTERY 0
 #define MTRACKD_DEFAULT_DELAY 1000
+#define MTRACKD_DEFAULT_ADAPTIVE 0
+#define MTRACKD_DEFAULT_DELAY_MIN 250
+#define MTRACKD_DEFAULT_DELAY_MAX 2000
+#define MTRACKD_DEFAULT_HOLD_DISABLED 0
+#define MTRACKD_DEFAULT_HOLD_ENABLED 0
+#define MTRACKD_DEFAULT_ARM_KEYS 1
+#define MTRACKD_DEFAULT_ARM_WINDOW 500
+#define MTRACKD_DEFAULT_TICK_BUDGET 0
+#define MTRACKD_DEFAULT_TOGGLE_BUDGET 0
+#define MTRACKD_DEFAULT_STRICT_BUDGET False
 #define MTRACKD_DEFAULT_PID_FILE NULL
+#define MTRACKD_DEFAULT_STATS_FILE NULL
+#define MTRACKD_DEFAULT_SOCKET NULL
+#define MTRACKD_DEFAULT_TRACE_FILE NULL
+#define MTRACKD_DEFAULT_TRACE_SIZE 65536
+#define MTRACKD_DEFAULT_LOW_JITTER False
+#define MTRACKD_DEFAULT_RT_POLICY "fifo"
+#define MTRACKD_DEFAULT_RT_PRIORITY 0
+#define MTRACKD_DEFAULT_CPU -1
+#define MTRACKD_DEFAULT_LOG "stderr"
 #define MTRACKD_DEFAULT_FG False
 #define MTRACKD_DEFAULT_DEBUG False
 
 typedef struct {
+	char* file;
+	int argc;
+	char** argv;
 	char* property;
 	uint8_t enable;
 	uint8_t disable;
+	Bool profiles;
 	Bool modifiers;
+	char* backend;
+	char* mechanism;
+	Bool control_thread;
+	char* displays;
 	int poll;
+	int poll_max;
+	int poll_battery;
 	int delay;
+	int adaptive;
+	int delay_min;
+	int delay_max;
+	int hold_disabled;
+	int hold_enabled;
+	int arm_keys;
+	int arm_window;
+	int tick_budget;
+	int toggle_budget;
+	Bool strict_budget;
 	char* pid_file;
 	Bool pid_file_created;
+	char* stats_file;
+	char* cache_file;
+	char* socket;
+	char* trace_file;
+	int trace_size;
+	Bool low_jitter;
+	char* rt_policy;
+	int rt_priority;
+	int cpu;
+	char* log;
 	Bool foreground;
 	Bool debug;
 } Config;
@@ -54,6 +111,22 @@ typedef struct {
  */
 Bool config_init(Config* obj, int argc, char** argv);
 
+/* Parse the commandline and config file again into next, leaving obj
+ * untouched. Returns False and frees next if the new configuration is
+ * invalid.
+ */
+Bool config_reload(Config* obj, Config* next);
+
+/* Watch the config file for changes. Returns a non-blocking inotify
+ * descriptor, or -1 if the file cannot be watched.
+ */
+int config_watch(Config* obj);
+
+/* Drain the watch descriptor. Returns True if the config file was written or
+ * replaced.
+ */
+Bool config_changed(Config* obj, int fd);
+
 /* Create a PID file if it was configured to do so.
  */
 int config_create_pid_file(Config* obj);
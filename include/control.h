@@ -22,40 +22,203 @@
 #ifndef __MTRACKD_CONTROL__
 #define __MTRACKD_CONTROL__
 
+#include <pthread.h>
+#include <stdio.h>
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/extensions/XInput.h>
+#include "proxy.h"
+#include "queue.h"
 
-#define MTRACKD_MAX_DEVICES 4
+#define MTRACKD_STATE_UNKNOWN -1
+
+/* Stack of the control thread. The default of several megabytes would all be
+ * locked in memory with low jitter enabled.
+ */
+#define MTRACKD_CONTROL_STACK (128 * 1024)
+
+/* Profile 0 is the configured property and values, the rest are the
+ * built-in profiles in order of preference.
+ */
+#define MTRACKD_PROFILE_CONFIGURED 0
+#define MTRACKD_PROFILE_COUNT 5
+#define MTRACKD_PROFILE_MAX_VALUES 2
+
+/* A way of disabling a device through an 8-bit integer property. The first
+ * element of the property is toggled between the enable and disable values,
+ * any further elements keep the values the device started with.
+ */
+typedef struct {
+	const char* name;
+	const char* property;
+	int values;
+	unsigned char enable;
+	unsigned char disable;
+} ControlProfile;
+
+/* A device is lost once a request made for it failed with BadDevice. It is
+ * no longer written to and is dropped when rediscovery next runs. The serial
+ * is that of the last request made for the device.
+ */
+typedef struct {
+	XDevice* device;
+	int profile;
+	unsigned int start_value;
+	int state;
+	int pending_writes;
+	unsigned long toggles;
+	unsigned long serial;
+	Bool lost;
+} ControlDevice;
 
 typedef struct {
 	char* property_name;
 	Atom property;
-	unsigned int start_values[MTRACKD_MAX_DEVICES];
+	Atom profile_atoms[MTRACKD_PROFILE_COUNT];
+	Atom touchpad_type;
+	Bool profiles;
 	unsigned int enable_value;
 	unsigned int disable_value;
 	Display* display;
-	XDevice* devices[MTRACKD_MAX_DEVICES];
+	ControlDevice* devices;
 	int device_count;
-	int device_state[MTRACKD_MAX_DEVICES];
+	int device_capacity;
+	int* device_index;
+	int device_index_size;
+	int property_notify_type;
+	int enabled;
+	Bool hotplug;
+	int xi_opcode;
+	Proxy* proxy;
+	char* cache_file;
+	Bool found_reported;
+	int retry_fd;
+	double retry_delay;
+	unsigned long devices_lost;
+	Bool threaded;
+	int stopping;
+	int requested;
+	int lost_fd;
+	int display_lost;
+	int held;
+	pthread_t owner;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	Queue queue;
 } Control;
 
-/* Initialize a Control object. Returns False on error.
+/* Initialize a Control object. When a proxy is given, toggling starts and
+ * stops forwarding its touchpad events and no device properties are used.
+ * With profiles, devices without the configured property are disabled
+ * through the first built-in profile they support. Returns False on error.
  */
 Bool control_init(Control* obj, Display* display, char* property_name,
-		int enable_value, int disable_value);
+		int enable_value, int disable_value, Bool profiles, Proxy* proxy);
 
-/* Find and load devices to control. Blocks until devices are found.
+/* Remember which devices have the property in the given file, so later
+ * searches can skip probing every device. NULL disables the cache.
+ */
+void control_set_cache(Control* obj, char* file);
+
+/* Reload the devices to control once without blocking and bring them to the
+ * current state.
+ */
+void control_rescan(Control* obj);
+
+/* Find and load devices to control, trying the devices in the cache first.
+ * When the server supports XInput2 devices which appear later are picked up
+ * from hierarchy events. Otherwise, if none were found, rediscovery is
+ * scheduled with backoff. Never blocks beyond the requests made.
  */
 void control_find_devices(Control* obj);
 
+/* Record that the request with the given serial failed with BadDevice for the
+ * given device id. Only the device the request was made for is marked lost,
+ * and rediscovery is scheduled to drop it and look for devices again. Makes
+ * no requests, so it is safe from the X error handler. Returns False if no
+ * managed device matches.
+ */
+Bool control_device_error(Control* obj, unsigned long serial, XID id);
+
+/* Return a timer file descriptor which becomes readable when rediscovery is
+ * due, or -1 if the thread or nothing needs it. Call control_retry then.
+ */
+int control_retry_fd(Control* obj);
+
+/* Drop lost devices and look for devices which are not managed yet. Further
+ * attempts back off exponentially while nothing is found and the server has
+ * no hierarchy events to announce devices.
+ */
+void control_retry(Control* obj);
+
+/* Change the property and values used to toggle devices. A new property is
+ * looked up and the devices are loaded again; new values are written to the
+ * devices immediately. Returns False and leaves the object unchanged if the
+ * property does not exist and there are no profiles to fall back on.
+ */
+Bool control_configure(Control* obj, char* property_name, int enable_value,
+		int disable_value);
+
 /* Free a Control object.
  */
 void control_free(Control* obj);
 
-/* Toggle the touchpads on/off.
+/* Free a Control object whose display connection has been lost, without
+ * sending anything to the server.
+ */
+void control_discard(Control* obj);
+
+/* Toggle the touchpads on/off. Only devices whose cached state differs from
+ * the requested one are written to. Never waits for a reply from the server.
+ * Only called by the thread applying states.
  */
 void control_toggle(Control* obj, int enable);
 
+/* Apply states and handle X events on a thread of its own, so slow writes and
+ * rescans do not hold up the listener. The display must not be used by
+ * anything else and XInitThreads must have been called. Other functions lock
+ * the object against the thread while they run. Returns False on error.
+ */
+Bool control_start_thread(Control* obj);
+
+/* Bring the touchpads to the state decided at the given time. Without a
+ * thread they are toggled right away. Otherwise only changes are queued and
+ * the thread applies the latest state queued, so this never blocks.
+ */
+void control_request(Control* obj, int enable, double time);
+
+/* Return a file descriptor which becomes readable when the thread lost its
+ * display connection, or -1 without a thread.
+ */
+int control_lost_fd(Control* obj);
+
+/* Called by the X I/O error handler for the thread's display, on whichever
+ * thread made the failed call. The display is marked lost so the thread
+ * returns from its loop without touching it again, and the loss is reported
+ * through control_lost_fd. Returns True with a thread, and the handler must
+ * then return so the failed call does and releases the lock normally.
+ */
+Bool control_thread_lost(Control* obj);
+
+/* Return True if the thread lost its display. Xlib may still hold the display
+ * lock for the thread then, so the display must be left unclosed.
+ */
+Bool control_display_lost(Control* obj);
+
+/* Handle an X event. Property changes made by other clients invalidate the
+ * cached device state and hierarchy changes add or remove single devices.
+ * Generic event data must already be retrieved. Returns True if the event was
+ * consumed.
+ */
+Bool control_handle_event(Control* obj, XEvent* event);
+
+/* Return the number of toggles over all devices.
+ */
+unsigned long control_toggles(Control* obj);
+
+/* Write the state and toggle count of every device to the given stream.
+ */
+void control_dump(Control* obj, FILE* out);
+
 #endif
 
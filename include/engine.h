@@ -0,0 +1,144 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_ENGINE__
+#define __MTRACKD_ENGINE__
+
+/* Keystroke times kept for the arming threshold.
+ */
+#define MTRACKD_ENGINE_MAX_KEYS 16
+
+/* Bytes in a keymap as returned by XQueryKeymap, one bit per keycode.
+ */
+#define MTRACKD_KEYMAP_SIZE 32
+
+/* Buckets of learned inter-key intervals, a third of an octave apart from
+ * 10 ms up to about 13 s. The last bucket holds everything longer.
+ */
+#define MTRACKD_ENGINE_PAUSE_BUCKETS 32
+
+/* The decision whether the trackpad should be enabled, separated from how
+ * keystrokes are detected and how the trackpad is toggled. Times are seconds
+ * on any monotonic clock and are always passed in, so the same code runs in
+ * the daemon and in dispad-replay.
+ */
+typedef struct {
+	int modifiers;
+	unsigned char mask[MTRACKD_KEYMAP_SIZE];
+	unsigned char current[MTRACKD_KEYMAP_SIZE];
+	unsigned char previous[MTRACKD_KEYMAP_SIZE];
+	double idle_time;
+	double delay;
+	int adaptive;
+	double delay_min;
+	double delay_max;
+	double last_key;
+	double pauses[MTRACKD_ENGINE_PAUSE_BUCKETS];
+	double pause_weight;
+	double pause_scale;
+	unsigned long pause_count;
+	double hold_disabled;
+	double hold_enabled;
+	int arm_keys;
+	double arm_window;
+	int paused;
+	int enabled;
+	int wanted;
+	double last_activity;
+	double changed;
+	double key_times[MTRACKD_ENGINE_MAX_KEYS];
+	unsigned int key_index;
+	unsigned long wanted_changes;
+	unsigned long changes;
+} Engine;
+
+/* Initialize an engine with the trackpad enabled, no hysteresis, no keys
+ * pressed and every key counting as typing. The delay is in milliseconds.
+ */
+void engine_init(Engine* obj, int idle_time);
+
+/* Set whether modifier keys count as typing.
+ */
+void engine_set_modifiers(Engine* obj, int modifiers);
+
+/* Mark a keycode as a modifier key.
+ */
+void engine_set_modifier_key(Engine* obj, int keycode);
+
+/* Take the pressed keys from a keymap without treating them as keystrokes.
+ */
+void engine_sync(Engine* obj, const unsigned char* keymap);
+
+/* Change how long (in ms) the trackpad stays disabled after a keystroke.
+ * With an adaptive delay this is only used until enough intervals are known.
+ */
+void engine_set_delay(Engine* obj, int idle_time);
+
+/* Learn the intervals between keystrokes and keep the trackpad disabled for
+ * the given percentile of them, but at least delay_min and at most delay_max
+ * ms. Older intervals count less and less. A percentile of zero uses the
+ * fixed delay again.
+ */
+void engine_set_adaptive(Engine* obj, int percentile, int delay_min, int delay_max);
+
+/* Set the minimum time (in ms) the trackpad stays disabled or enabled once
+ * changed, and the number of keystrokes within arm_window ms it takes to
+ * disable it.
+ */
+void engine_set_hysteresis(Engine* obj, int hold_disabled, int hold_enabled,
+		int arm_keys, int arm_window);
+
+/* Record a keystroke.
+ */
+void engine_key(Engine* obj, double time);
+
+/* Track a key press or release. Records a keystroke and returns non-zero if
+ * it counts as typing: a new press of a non-modifier key, or any change of a
+ * modifier key when modifiers count.
+ */
+int engine_key_event(Engine* obj, int press, int keycode, double time);
+
+/* Compare a polled keymap with the previous one. Records a keystroke and
+ * returns non-zero if a non-modifier key was pressed since, or a modifier key
+ * is held when modifiers count.
+ */
+int engine_keymap(Engine* obj, const unsigned char* keymap, double time);
+
+/* Return non-zero if a modifier key is held and modifiers count.
+ */
+int engine_modifier_held(Engine* obj);
+
+/* Record activity which extends the delay without counting as a keystroke,
+ * such as a held modifier key.
+ */
+void engine_hold(Engine* obj, double time);
+
+/* While paused the trackpad stays enabled.
+ */
+void engine_pause(Engine* obj, int paused);
+
+/* Decide whether the trackpad should be enabled at the given time. Sets
+ * deadline to the next time the decision may change without further input,
+ * or zero if it will not. Returns non-zero for enabled.
+ */
+int engine_decide(Engine* obj, double time, double* deadline);
+
+#endif
@@ -0,0 +1,64 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_EVDEV__
+#define __MTRACKD_EVDEV__
+
+#include <X11/Xlib.h>
+
+#define MTRACKD_EVDEV_DIR "/dev/input"
+#define MTRACKD_EVDEV_MAX_KEYBOARDS 16
+
+/* Called for every key press or release read from a keyboard. The keycode is
+ * translated to the X keycode space and time is the kernel event timestamp in
+ * seconds on the monotonic clock.
+ */
+typedef void (*EvdevKeyHandler)(void* data, Bool press, int keycode, double time);
+
+typedef struct {
+	int epoll_fd;
+	int watch_fd;
+	int fds[MTRACKD_EVDEV_MAX_KEYBOARDS];
+	Bool monotonic[MTRACKD_EVDEV_MAX_KEYBOARDS];
+	int fd_count;
+} Evdev;
+
+/* Open all keyboard event devices and watch for new ones. Returns False if no
+ * keyboard could be opened.
+ */
+Bool evdev_init(Evdev* obj);
+
+/* Return a file descriptor which becomes readable when keyboard events are
+ * pending.
+ */
+int evdev_fd(Evdev* obj);
+
+/* Read all pending keyboard events without blocking and pass key presses and
+ * releases to the handler.
+ */
+void evdev_read(Evdev* obj, EvdevKeyHandler handler, void* data);
+
+/* Close all keyboard devices.
+ */
+void evdev_free(Evdev* obj);
+
+#endif
+
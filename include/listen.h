@@ -24,27 +24,82 @@
 
 #include <X11/Xlib.h>
 #include "control.h"
+#include "engine.h"
+#include "evdev.h"
+#include "loop.h"
 
-#define MTRACKD_KEYMAP_SIZE 32
+
+#define MTRACKD_BACKEND_POLL 0
+#define MTRACKD_BACKEND_XINPUT2 1
+#define MTRACKD_BACKEND_EVDEV 2
 
 typedef struct {
-	Bool modifiers;
-	double idle_time;
+	Engine engine;
 	int poll_time;
+	int poll_max;
+	int poll_battery;
+	int poll_interval;
+	Bool on_battery;
+	double power_checked;
+	double key_time;
+	double poll_last;
+	double deadline;
+	unsigned long request;
+	unsigned long round_trips;
 	Display* display;
-	unsigned char mask[MTRACKD_KEYMAP_SIZE];
-	unsigned char current[MTRACKD_KEYMAP_SIZE];
-	unsigned char previous[MTRACKD_KEYMAP_SIZE];
+	Control* control;
+	int backend;
+	int xi_opcode;
+	int timer_fd;
+	Evdev evdev;
+	unsigned char keymap[MTRACKD_KEYMAP_SIZE];
 } Listen;
 
-/* Initialize a listener object. Returns False on error.
+/* Initialize a listener object. The backend is one of "auto", "xinput2",
+ * "evdev" or "poll". When polling, the interval starts at poll_time and backs
+ * off to poll_max while idle, or to poll_battery when running on battery and
+ * poll_battery is not zero. Returns False on error.
+ */
+Bool listen_init(Listen* obj, Display* display, char* backend, Bool modifiers,
+		int idle_time, int poll_time, int poll_max, int poll_battery);
+
+/* Register the listener with an event loop. Calls control_toggle on the given
+ * Control object. Waits for XInput2 raw key events or evdev key events when
+ * available and falls back to polling the keymap otherwise. Returns False on
+ * error.
+ */
+Bool listen_start(Listen* obj, Control* ctrl, Loop* loop);
+
+/* Remove the listener from the event loop it was started with.
+ */
+void listen_stop(Listen* obj, Loop* loop);
+
+/* Change the timing parameters of a running listener. Takes effect before the
+ * listener next goes to sleep.
+ */
+void listen_configure(Listen* obj, Bool modifiers, int idle_time, int poll_time,
+		int poll_max, int poll_battery);
+
+/* Set the hysteresis applied before toggling. Once disabled the trackpad
+ * stays disabled for at least hold_disabled ms, and once enabled it stays
+ * enabled for at least hold_enabled ms. It is only disabled after arm_keys
+ * keystrokes within arm_window ms. All zero or one disables hysteresis.
+ */
+void listen_set_hysteresis(Listen* obj, int hold_disabled, int hold_enabled,
+		int arm_keys, int arm_window);
+
+/* Learn the delay from the given percentile of the pauses between keystrokes,
+ * kept between delay_min and delay_max ms. Zero uses the fixed delay.
+ */
+void listen_set_adaptive(Listen* obj, int percentile, int delay_min, int delay_max);
+
+/* Pause or resume the listener. While paused the trackpads stay enabled.
  */
-Bool listen_init(Listen* obj, Display* display, Bool modifiers,
-		int idle_time, int poll_time);
+void listen_pause(Listen* obj, Bool paused);
 
-/* Run the listener loop. Calls control_toggle on the given Control object.
+/* Free any resources held by a listener object.
  */
-void listen_run(Listen* obj, Control* ctrl);
+void listen_free(Listen* obj);
 
 #endif
 
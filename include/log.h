@@ -0,0 +1,58 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_LOG__
+#define __MTRACKD_LOG__
+
+/* Records held by the ring, and the longest message kept including its
+ * prefix. Longer messages are truncated.
+ */
+#define MTRACKD_LOG_RECORDS 1024
+#define MTRACKD_LOG_RECORD_SIZE 256
+
+/* Stack size of the writer thread, which only formats into fixed buffers.
+ */
+#define MTRACKD_LOG_STACK (64 * 1024)
+
+/* Log a message with a prefix such as "[I] ". Once the writer is started the
+ * message is formatted into the ring and written by the writer thread, or
+ * counted as dropped if the ring is full. Never blocks or allocates then.
+ * Before that it is written to stderr directly.
+ */
+void log_printf(const char* prefix, const char* format, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* Start the writer thread. The target is "stderr", "syslog" or the path of a
+ * file to append to. Returns 0 on error.
+ */
+int log_start(const char* target);
+
+/* Write out every queued message and stop the writer thread. Later messages
+ * go to stderr directly.
+ */
+void log_stop();
+
+/* Return the number of messages dropped because the ring was full or they
+ * could not be written.
+ */
+unsigned long log_dropped();
+
+#endif
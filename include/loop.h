@@ -0,0 +1,96 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_LOOP__
+#define __MTRACKD_LOOP__
+
+#include <X11/Xlib.h>
+#include <stdint.h>
+
+#define MTRACKD_LOOP_MAX_WATCHES 128
+#define MTRACKD_LOOP_MAX_PREPARE 32
+
+/* Called when a watched file descriptor becomes ready. The events are the
+ * epoll event flags.
+ */
+typedef void (*LoopHandler)(void* data, uint32_t events);
+
+/* Called before the loop goes to sleep.
+ */
+typedef void (*LoopPrepare)(void* data);
+
+typedef struct {
+	int fd;
+	LoopHandler handler;
+	void* data;
+} LoopWatch;
+
+typedef struct {
+	int epoll_fd;
+	Bool running;
+	unsigned long wakeups;
+	LoopWatch watches[MTRACKD_LOOP_MAX_WATCHES];
+	LoopPrepare prepare[MTRACKD_LOOP_MAX_PREPARE];
+	void* prepare_data[MTRACKD_LOOP_MAX_PREPARE];
+	int prepare_count;
+} Loop;
+
+/* Initialize an event loop. Returns False on error.
+ */
+Bool loop_init(Loop* obj);
+
+/* Call the handler whenever the file descriptor is readable. Returns False on
+ * error.
+ */
+Bool loop_add(Loop* obj, int fd, LoopHandler handler, void* data);
+
+/* Change the epoll events a watched file descriptor is waited for, for
+ * example to add EPOLLOUT while output is pending.
+ */
+void loop_set_events(Loop* obj, int fd, uint32_t events);
+
+/* Stop watching a file descriptor.
+ */
+void loop_remove(Loop* obj, int fd);
+
+/* Call a function each time before the loop waits for events. Returns False
+ * on error.
+ */
+Bool loop_add_prepare(Loop* obj, LoopPrepare prepare, void* data);
+
+/* Stop calling a function added with loop_add_prepare.
+ */
+void loop_remove_prepare(Loop* obj, LoopPrepare prepare, void* data);
+
+/* Dispatch events until loop_stop is called.
+ */
+void loop_run(Loop* obj);
+
+/* Make loop_run return after the current iteration.
+ */
+void loop_stop(Loop* obj);
+
+/* Free an event loop.
+ */
+void loop_free(Loop* obj);
+
+#endif
+
@@ -0,0 +1,85 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_PROXY__
+#define __MTRACKD_PROXY__
+
+#include <stdio.h>
+#include <X11/Xlib.h>
+#include <linux/input.h>
+#include "evdev.h"
+
+#define MTRACKD_PROXY_MAX_TOUCHPADS 8
+#define MTRACKD_UINPUT_DEV "/dev/uinput"
+
+#define MTRACKD_LONGS(x) (((x) + sizeof(long) * 8 - 1) / (sizeof(long) * 8))
+
+typedef struct {
+	int source_fd;
+	int sink_fd;
+	int slots;
+	int slot;
+	Bool forwarding;
+	int keys_down;
+	unsigned long keys[MTRACKD_LONGS(KEY_CNT)];
+} ProxyDevice;
+
+typedef struct {
+	int epoll_fd;
+	int watch_fd;
+	ProxyDevice devices[MTRACKD_PROXY_MAX_TOUCHPADS];
+	int device_count;
+	Bool enabled;
+	unsigned long toggles;
+	unsigned long dropped;
+} Proxy;
+
+/* Grab every touchpad event device and create a uinput clone of each one that
+ * its events are forwarded to. Watches for new touchpads. Returns False if no
+ * touchpad could be proxied.
+ */
+Bool proxy_init(Proxy* obj);
+
+/* Return a file descriptor which becomes readable when touchpad events are
+ * pending.
+ */
+int proxy_fd(Proxy* obj);
+
+/* Read all pending touchpad events without blocking and forward them to the
+ * clones unless the touchpads are disabled.
+ */
+void proxy_read(Proxy* obj);
+
+/* Start or stop forwarding events. Disabling releases any touches and buttons
+ * held on the clones; enabling waits for the fingers to lift before
+ * forwarding again. Returns True if the state changed.
+ */
+Bool proxy_toggle(Proxy* obj, int enable);
+
+/* Write the number of proxied touchpads and dropped events to the stream.
+ */
+void proxy_dump(Proxy* obj, FILE* out);
+
+/* Release the touchpads and destroy their clones.
+ */
+void proxy_free(Proxy* obj);
+
+#endif
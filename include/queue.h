@@ -0,0 +1,78 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_QUEUE__
+#define __MTRACKD_QUEUE__
+
+/* Commands held by a queue. Must be a power of two.
+ */
+#define MTRACKD_QUEUE_SIZE 64
+
+/* A state the control side should bring the trackpads to, and when it was
+ * decided.
+ */
+typedef struct {
+	double time;
+	int enable;
+} QueueCommand;
+
+/* Lock-free queue between exactly one producer and one consumer thread. The
+ * producer owns head and the consumer owns tail, and each only reads the
+ * other's. The eventfd becomes readable when commands were pushed.
+ */
+typedef struct {
+	QueueCommand commands[MTRACKD_QUEUE_SIZE];
+	unsigned long head __attribute__((aligned(64)));
+	unsigned long tail __attribute__((aligned(64)));
+	int fd;
+} Queue;
+
+/* Initialize an empty queue. Returns 0 on error.
+ */
+int queue_init(Queue* obj);
+
+/* Free a queue. Neither thread may use it any more.
+ */
+void queue_free(Queue* obj);
+
+/* Append a command and wake the consumer. Only called by the producer. Never
+ * blocks or allocates. Returns 0 if the queue is full.
+ */
+int queue_push(Queue* obj, double time, int enable);
+
+/* Wake the consumer without a command, for example to make it stop.
+ */
+void queue_wake(Queue* obj);
+
+/* Take the oldest command. Only called by the consumer. Returns 0 if the
+ * queue is empty.
+ */
+int queue_pop(Queue* obj, QueueCommand* command);
+
+/* Reset the wakeup once the consumer is about to drain the queue.
+ */
+void queue_clear(Queue* obj);
+
+/* Return the eventfd to wait on for commands.
+ */
+int queue_fd(Queue* obj);
+
+#endif
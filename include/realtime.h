@@ -0,0 +1,44 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_REALTIME__
+#define __MTRACKD_REALTIME__
+
+#include <X11/Xlib.h>
+
+/* Nice value tried when real-time scheduling is not permitted.
+ */
+#define MTRACKD_REALTIME_NICE -10
+
+/* Stack pre-faulted at startup, so the first deep call does not fault.
+ */
+#define MTRACKD_REALTIME_STACK (256 * 1024)
+
+/* Reduce scheduling jitter for the process. Locks all current and future
+ * memory and pre-faults the calling thread's stack. When priority is greater
+ * than zero runs every thread under the given policy ("fifo" or "rr") at that
+ * priority, or at a high nice value if that is not permitted. When cpu is not
+ * negative pins every thread to that CPU. Threads started later inherit both.
+ * Returns False if memory could not be locked; the other steps only warn.
+ */
+Bool realtime_enter(const char* policy, int priority, int cpu);
+
+#endif
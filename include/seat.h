@@ -0,0 +1,83 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_SEAT__
+#define __MTRACKD_SEAT__
+
+#include <stdio.h>
+#include <X11/Xlib.h>
+#include "conf.h"
+#include "control.h"
+#include "listen.h"
+#include "loop.h"
+
+typedef struct {
+	char* name;
+	Display* display;
+	Display* control_display;
+	Control control;
+	Listen listen;
+	int xi_major;
+	int xi_error;
+	int error_fd;
+	Bool active;
+} Seat;
+
+/* Split a comma separated list of display names. Returns the number of names
+ * stored in a newly allocated array, or 0 if the list is empty.
+ */
+int seat_split(char* list, char*** names);
+
+/* Connect to an X display and start disabling its trackpads from the given
+ * event loop. A NULL name uses the DISPLAY environment variable. The proxy is
+ * NULL unless trackpads are disabled through uinput. With a control thread
+ * the trackpads are written through a second connection. The lost handler is
+ * called with the seat when that connection is lost or after seat_error.
+ * Returns False on error.
+ */
+Bool seat_open(Seat* obj, char* name, Config* config, Proxy* proxy, Loop* loop,
+		LoopHandler lost);
+
+/* Find the seat using a display connection for listening or control. Returns
+ * NULL if none does.
+ */
+Seat* seat_find(Seat* seats, int count, Display* display);
+
+/* Report an X error which leaves the seat unusable, so the lost handler drops
+ * it from the loop. Makes no requests, so it is safe from the X error handler
+ * on any thread.
+ */
+void seat_error(Seat* obj);
+
+/* Write the display name and device statistics of a seat to the given stream.
+ */
+void seat_dump(Seat* obj, FILE* out);
+
+/* Stop serving a display and restore its trackpads.
+ */
+void seat_close(Seat* obj, Loop* loop);
+
+/* Stop serving a display whose connection has been lost. Nothing is sent to
+ * the server.
+ */
+void seat_lost(Seat* obj, Loop* loop);
+
+#endif
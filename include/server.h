@@ -0,0 +1,68 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_SERVER__
+#define __MTRACKD_SERVER__
+
+#include <X11/Xlib.h>
+#include "loop.h"
+#include "seat.h"
+
+#define MTRACKD_SERVER_MAX_CLIENTS 8
+#define MTRACKD_SERVER_INPUT_SIZE 256
+#define MTRACKD_SERVER_OUTPUT_SIZE 8192
+#define MTRACKD_SERVER_STALLS 4
+
+struct Server;
+
+typedef struct {
+	int fd;
+	struct Server* server;
+	char input[MTRACKD_SERVER_INPUT_SIZE];
+	int input_len;
+	char* output;
+	int output_len;
+	int output_size;
+	int stalls;
+	Bool overflow;
+} ServerClient;
+
+typedef struct Server {
+	char* path;
+	int fd;
+	Loop* loop;
+	Seat* seats;
+	int seat_count;
+	ServerClient clients[MTRACKD_SERVER_MAX_CLIENTS];
+} Server;
+
+/* Listen for commands on a Unix domain socket at the given path and serve
+ * them from the event loop. Commands apply to every active seat. Returns False
+ * on error.
+ */
+Bool server_init(Server* obj, char* path, Loop* loop, Seat* seats, int seat_count);
+
+/* Close the socket and all client connections.
+ */
+void server_free(Server* obj);
+
+#endif
+
@@ -0,0 +1,104 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_STATS__
+#define __MTRACKD_STATS__
+
+#include <stdio.h>
+#include <X11/Xlib.h>
+
+/* Bucket i counts samples below 2^i microseconds, the last bucket counts
+ * everything longer.
+ */
+#define MTRACKD_STATS_BUCKETS 24
+
+typedef struct {
+	const char* name;
+	unsigned long buckets[MTRACKD_STATS_BUCKETS];
+	unsigned long count;
+	double sum;
+	double max;
+} Histogram;
+
+/* X protocol requests made per tick or per toggle, and how many of those
+ * waited for a reply. A budget of zero is unlimited.
+ */
+typedef struct {
+	const char* name;
+	unsigned long count;
+	unsigned long requests;
+	unsigned long round_trips;
+	unsigned long max;
+	unsigned long budget;
+	unsigned long over;
+} Requests;
+
+typedef struct {
+	double start;
+	unsigned long wanted;
+	unsigned long changed;
+	Histogram detect;
+	Histogram enable;
+	Histogram get;
+	Histogram set;
+	Histogram apply;
+	Requests tick;
+	Requests toggle;
+} Stats;
+
+extern Stats stats;
+
+/* Reset all statistics.
+ */
+void stats_init(Stats* obj);
+
+/* Record a duration in seconds. Does not allocate or block, and is safe to
+ * call from several threads at once.
+ */
+void stats_record(Histogram* hist, double seconds);
+
+/* Record the requests and round trips made by one tick or toggle. Returns
+ * False if they exceeded the budget for the first time or by more than ever
+ * before, so overruns can be reported without flooding the log. Safe to call
+ * from several threads at once.
+ */
+Bool stats_requests(Requests* req, unsigned long requests, unsigned long round_trips);
+
+/* Estimate a percentile (0-100) of a histogram in seconds from its buckets.
+ */
+double stats_percentile(Histogram* hist, double percentile);
+
+/* Return the CPU time used by the process in seconds.
+ */
+double stats_cpu_time();
+
+/* Write the uptime, CPU time, the given number of loop wakeups, the trackpad
+ * state changes and all histograms to the given stream.
+ */
+void stats_dump(Stats* obj, FILE* out, unsigned long wakeups);
+
+/* Write the state change counts and all histograms as the members of a JSON object, without the
+ * enclosing braces.
+ */
+void stats_write(Stats* obj, FILE* out);
+
+#endif
+
@@ -0,0 +1,104 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#ifndef __MTRACKD_TRACE__
+#define __MTRACKD_TRACE__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MTRACKD_TRACE_MAGIC 0x54505344
+#define MTRACKD_TRACE_VERSION 1
+
+/* Record types. The value of a decision is 1 for enabled and 0 for disabled,
+ * of a write the number of devices written and of a config record the delay
+ * in ms.
+ */
+#define MTRACKD_TRACE_KEY 1
+#define MTRACKD_TRACE_HOLD 2
+#define MTRACKD_TRACE_DECISION 3
+#define MTRACKD_TRACE_WRITE 4
+#define MTRACKD_TRACE_CONFIG 5
+
+typedef struct {
+	double time;
+	uint32_t type;
+	uint32_t value;
+} TraceRecord;
+
+/* The head counts every record ever written, so the oldest record still in
+ * the ring is at head - capacity once the ring has wrapped.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t record_size;
+	uint64_t head;
+} TraceHeader;
+
+typedef struct {
+	int fd;
+	TraceHeader* header;
+	TraceRecord* records;
+	size_t size;
+} Trace;
+
+extern Trace trace;
+
+/* Initialize a trace which records nothing until opened.
+ */
+void trace_init(Trace* obj);
+
+/* Map a trace file holding the given number of records. An existing trace
+ * of the same capacity is appended to, anything else is replaced. When
+ * capacity is zero the file is mapped read-only as it is. Returns 0 on error.
+ */
+int trace_open(Trace* obj, const char* path, uint32_t capacity);
+
+/* Return the number of records in the ring and the index of the oldest.
+ */
+uint64_t trace_count(Trace* obj, uint64_t* first);
+
+/* Return a record by its index as counted by the head.
+ */
+TraceRecord* trace_get(Trace* obj, uint64_t index);
+
+/* Unmap the trace file.
+ */
+void trace_close(Trace* obj);
+
+/* Append a record. Does nothing unless the trace is open and never
+ * allocates or makes a system call.
+ */
+static inline void trace_record(Trace* obj, uint32_t type, double time, uint32_t value) {
+	TraceRecord* rec;
+	if (obj->header == NULL)
+		return;
+	/* the listener and control threads may record at the same time */
+	rec = &obj->records[__atomic_fetch_add(&obj->header->head, 1, __ATOMIC_RELAXED) %
+		obj->header->capacity];
+	rec->time = time;
+	rec->type = type;
+	rec->value = value;
+}
+
+#endif
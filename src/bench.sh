@@ -0,0 +1,85 @@
+#!/bin/sh
+# Runs dispad against Xvfb for every combination of backend, poll and delay,
+# types bursts of keystrokes through XTest with xdotool and appends each run's
+# statistics as one line of JSON to $BENCH_OUT. Xvfb has no touchpad, so the
+# trackpad is never toggled there: each line carries "touchpad": false and the
+# enable, get, set, apply and toggle_requests entries are null rather than
+# empty. Set BENCH_DISPLAY to use a running server with a touchpad instead.
+
+XVFB=${XVFB:-Xvfb}
+XDOTOOL=${XDOTOOL:-xdotool}
+BENCH_OUT=${BENCH_OUT:-bench.json}
+BENCH_BACKENDS=${BENCH_BACKENDS:-"poll xinput2"}
+BENCH_POLLS=${BENCH_POLLS:-"10 50"}
+BENCH_DELAYS=${BENCH_DELAYS:-"500 1000"}
+BENCH_ROUNDS=${BENCH_ROUNDS:-10}
+BENCH_LABEL=${BENCH_LABEL:-`git describe --always --dirty 2>/dev/null || echo unknown`}
+touchpad=true
+
+if ! command -v "$XDOTOOL" >/dev/null 2>&1; then
+	echo "bench: xdotool is needed to type through XTest" >&2
+	exit 1
+fi
+
+tmp=`mktemp -d` || exit 1
+trap 'test -n "$xvfb" && kill $xvfb 2>/dev/null; rm -rf "$tmp"' EXIT
+
+if [ -z "$BENCH_DISPLAY" ]; then
+	if ! command -v "$XVFB" >/dev/null 2>&1; then
+		echo "bench: Xvfb is needed unless BENCH_DISPLAY is set" >&2
+		exit 1
+	fi
+	BENCH_DISPLAY=:98
+	touchpad=false
+	"$XVFB" "$BENCH_DISPLAY" -nolisten tcp >"$tmp/xvfb.log" 2>&1 &
+	xvfb=$!
+	sleep 1
+	if ! kill -0 $xvfb 2>/dev/null; then
+		echo "bench: Xvfb failed to start" >&2
+		exit 1
+	fi
+fi
+
+for backend in $BENCH_BACKENDS; do
+	for poll in $BENCH_POLLS; do
+		for delay in $BENCH_DELAYS; do
+			rm -f "$tmp/stats.json"
+			cat >"$tmp/dispad.conf" <<CONF
+backend = "$backend"
+poll = $poll
+delay = $delay
+statsfile = "$tmp/stats.json"
+cachefile = ""
+CONF
+			./dispad -F -c "$tmp/dispad.conf" -x "$BENCH_DISPLAY" 2>"$tmp/dispad.log" &
+			dispad=$!
+			sleep 1
+			round=0
+			while [ $round -lt $BENCH_ROUNDS ]; do
+				# a burst of typing, then long enough idle for the
+				# trackpad to come back
+				DISPLAY=$BENCH_DISPLAY "$XDOTOOL" type --delay 120 \
+					"the quick brown fox jumps" >/dev/null 2>&1
+				sleep `expr $delay / 1000 + 1`
+				round=`expr $round + 1`
+			done
+			kill -TERM $dispad
+			wait $dispad
+			if [ ! -s "$tmp/stats.json" ]; then
+				echo "bench: no statistics from $backend poll=$poll delay=$delay" >&2
+				cat "$tmp/dispad.log" >&2
+				exit 1
+			fi
+			sed "s/^{/{\"label\": \"$BENCH_LABEL\", \"touchpad\": $touchpad, /" \
+				"$tmp/stats.json" >"$tmp/run.json"
+			if [ $touchpad = false ]; then
+				# nothing was toggled, so there is no toggle latency to report
+				sed -E 's/"(enable|get|set|apply|toggle_requests)": \{[^}]*\}/"\1": null/g' \
+					"$tmp/run.json" >>"$BENCH_OUT"
+			else
+				cat "$tmp/run.json" >>"$BENCH_OUT"
+			fi
+			echo "bench: $backend poll=$poll delay=$delay done"
+		done
+	done
+done
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Runs dispad against a private Xvfb with a tight tickbudget and strictbudget
+# on, failing if any idle tick went over. Xvfb has no touchpad, so nothing is
+# ever toggled and togglebudget is not exercised. Requests are counted by
+# dispad itself, not by an independent observer, and round trips are not
+# checked. Skipped (exit 77) when Xvfb is not installed.
+
+XVFB=${XVFB:-Xvfb}
+XDOTOOL=${XDOTOOL:-xdotool}
+DISPLAY_NAME=${BUDGET_DISPLAY:-:97}
+
+command -v "$XVFB" >/dev/null 2>&1 || exit 77
+
+tmp=`mktemp -d` || exit 1
+trap 'kill $xvfb 2>/dev/null; rm -rf "$tmp"' EXIT
+
+"$XVFB" "$DISPLAY_NAME" -nolisten tcp >"$tmp/xvfb.log" 2>&1 &
+xvfb=$!
+sleep 1
+kill -0 $xvfb 2>/dev/null || exit 77
+
+cat >"$tmp/dispad.conf" <<CONF
+backend = "poll"
+poll = 20
+pollmax = 20
+delay = 200
+tickbudget = 1
+strictbudget = true
+cachefile = ""
+CONF
+
+./dispad -F -c "$tmp/dispad.conf" -x "$DISPLAY_NAME" &
+dispad=$!
+sleep 1
+if command -v "$XDOTOOL" >/dev/null 2>&1; then
+	DISPLAY=$DISPLAY_NAME "$XDOTOOL" type --delay 150 "the quick brown fox" \
+		>/dev/null 2>&1
+fi
+sleep 2
+kill -TERM $dispad
+wait $dispad
+status=$?
+if [ $status -ne 0 ]; then
+	echo "dispad exited with status $status" >&2
+	exit 1
+fi
+exit 0
@@ -0,0 +1,308 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "engine.h"
+#include <stdio.h>
+
+/* Plain keys and a modifier under X.org.
+ */
+#define CHECK_KEY_A 38
+#define CHECK_KEY_S 39
+#define CHECK_KEY_SHIFT 50
+
+/* Scripted input starts at a large uptime, where a double has the least
+ * precision left for sub-millisecond deadlines.
+ */
+#define CHECK_START 1000000.0
+
+/* A step of a script. Times are seconds after CHECK_START.
+ */
+typedef struct {
+	double time;
+	char op;
+	int value;
+} CheckStep;
+
+/* Press, release and hold take a keycode, expect takes the state the engine
+ * must decide at that time, deadline the deadline it must report.
+ */
+#define CHECK_PRESS 'p'
+#define CHECK_RELEASE 'r'
+#define CHECK_HOLD 'h'
+#define CHECK_EXPECT 'e'
+#define CHECK_DEADLINE 'd'
+
+static int check_count = 0;
+static int check_failures = 0;
+
+static void check(int ok, const char* name, const char* what, double time) {
+	check_count++;
+	if (ok)
+		return;
+	check_failures++;
+	fprintf(stderr, "FAIL %s: %s at %.3f s\n", name, what, time);
+}
+
+/* Run a script through the engine, deciding at every step as the listener
+ * does at every wakeup.
+ */
+static void check_script(Engine* engine, const char* name, const CheckStep* steps, int count) {
+	int i, enabled;
+	double deadline, time;
+
+	for (i = 0; i < count; i++) {
+		time = CHECK_START + steps[i].time;
+		if (steps[i].op == CHECK_PRESS)
+			engine_key_event(engine, 1, steps[i].value, time);
+		else if (steps[i].op == CHECK_RELEASE)
+			engine_key_event(engine, 0, steps[i].value, time);
+		else if (steps[i].op == CHECK_HOLD)
+			engine_hold(engine, time);
+		enabled = engine_decide(engine, time, &deadline);
+
+		switch (steps[i].op) {
+		case CHECK_EXPECT:
+			check(enabled == steps[i].value, name, steps[i].value ? "expected enabled" :
+				"expected disabled", steps[i].time);
+			break;
+		case CHECK_DEADLINE:
+			check(deadline > 0 && deadline - CHECK_START > steps[i].value / 1000.0 - 0.0005 &&
+				deadline - CHECK_START < steps[i].value / 1000.0 + 0.0005, name,
+				"unexpected deadline", steps[i].time);
+			break;
+		}
+	}
+}
+
+static void check_delay() {
+	Engine engine;
+	static const CheckStep steps[] = {
+		{ 1.000, CHECK_PRESS, CHECK_KEY_A },
+		{ 1.000, CHECK_EXPECT, 0 },
+		{ 1.000, CHECK_DEADLINE, 1500 },
+		{ 1.050, CHECK_RELEASE, CHECK_KEY_A },
+		{ 1.400, CHECK_EXPECT, 0 },
+		{ 1.510, CHECK_EXPECT, 1 },
+		/* autorepeat does not extend the delay */
+		{ 2.000, CHECK_PRESS, CHECK_KEY_S },
+		{ 2.300, CHECK_PRESS, CHECK_KEY_S },
+		{ 2.450, CHECK_EXPECT, 0 },
+		{ 2.510, CHECK_EXPECT, 1 },
+		{ 2.600, CHECK_RELEASE, CHECK_KEY_S },
+		/* a long idle period leaves it enabled */
+		{ 86400.0, CHECK_EXPECT, 1 },
+		{ 86400.0, CHECK_PRESS, CHECK_KEY_A },
+		{ 86400.0, CHECK_EXPECT, 0 },
+		{ 86400.501, CHECK_EXPECT, 1 },
+	};
+
+	engine_init(&engine, 500);
+	check_script(&engine, "delay", steps, sizeof(steps) / sizeof(steps[0]));
+	check(engine.changes == 6, "delay", "expected 6 toggles", 0);
+}
+
+static void check_modifiers() {
+	Engine engine;
+	static const CheckStep ignored[] = {
+		{ 1.000, CHECK_PRESS, CHECK_KEY_SHIFT },
+		{ 1.000, CHECK_EXPECT, 1 },
+		{ 1.200, CHECK_RELEASE, CHECK_KEY_SHIFT },
+		{ 1.200, CHECK_EXPECT, 1 },
+		/* a key pressed under a held modifier still counts */
+		{ 2.000, CHECK_PRESS, CHECK_KEY_SHIFT },
+		{ 2.100, CHECK_PRESS, CHECK_KEY_A },
+		{ 2.100, CHECK_EXPECT, 0 },
+	};
+	static const CheckStep counted[] = {
+		{ 1.000, CHECK_PRESS, CHECK_KEY_SHIFT },
+		{ 1.000, CHECK_EXPECT, 0 },
+		{ 1.400, CHECK_HOLD, CHECK_KEY_SHIFT },
+		{ 1.800, CHECK_EXPECT, 0 },
+		{ 1.800, CHECK_RELEASE, CHECK_KEY_SHIFT },
+		{ 2.250, CHECK_EXPECT, 0 },
+		{ 2.310, CHECK_EXPECT, 1 },
+	};
+
+	engine_init(&engine, 500);
+	engine_set_modifier_key(&engine, CHECK_KEY_SHIFT);
+	check_script(&engine, "modifiers ignored", ignored, sizeof(ignored) / sizeof(ignored[0]));
+	check(engine_modifier_held(&engine) == 0, "modifiers ignored", "modifier counted as held", 0);
+
+	engine_init(&engine, 500);
+	engine_set_modifier_key(&engine, CHECK_KEY_SHIFT);
+	engine_set_modifiers(&engine, 1);
+	check_script(&engine, "modifiers counted", counted, sizeof(counted) / sizeof(counted[0]));
+}
+
+static void check_hold() {
+	Engine engine;
+	static const CheckStep steps[] = {
+		{ 1.000, CHECK_PRESS, CHECK_KEY_A },
+		{ 1.000, CHECK_EXPECT, 0 },
+		{ 1.000, CHECK_RELEASE, CHECK_KEY_A },
+		/* the delay ran out, but the trackpad stays disabled for the hold */
+		{ 1.500, CHECK_EXPECT, 0 },
+		{ 1.500, CHECK_DEADLINE, 2000 },
+		{ 2.001, CHECK_EXPECT, 1 },
+		/* typing right after it came back waits for the enabled hold */
+		{ 2.100, CHECK_PRESS, CHECK_KEY_A },
+		{ 2.100, CHECK_EXPECT, 1 },
+		{ 2.100, CHECK_DEADLINE, 2301 },
+		{ 2.250, CHECK_EXPECT, 1 },
+		{ 2.350, CHECK_EXPECT, 0 },
+	};
+
+	engine_init(&engine, 200);
+	engine_set_hysteresis(&engine, 1000, 300, 1, 0);
+	engine_set_delay(&engine, 500);
+	check_script(&engine, "hold", steps, sizeof(steps) / sizeof(steps[0]));
+	check(engine.changes == 3, "hold", "expected 3 toggles", 0);
+	/* holds put changes off without dropping any here */
+	check(engine.wanted_changes == engine.changes, "hold", "expected no changes held back", 0);
+}
+
+static void check_arm() {
+	Engine engine;
+	static const CheckStep steps[] = {
+		/* three keys spread wider than the window never arm it */
+		{ 1.000, CHECK_PRESS, CHECK_KEY_A },
+		{ 1.000, CHECK_RELEASE, CHECK_KEY_A },
+		{ 1.400, CHECK_PRESS, CHECK_KEY_A },
+		{ 1.400, CHECK_RELEASE, CHECK_KEY_A },
+		{ 1.800, CHECK_PRESS, CHECK_KEY_A },
+		{ 1.800, CHECK_RELEASE, CHECK_KEY_A },
+		{ 1.800, CHECK_EXPECT, 1 },
+		/* three within the window do */
+		{ 5.000, CHECK_PRESS, CHECK_KEY_A },
+		{ 5.000, CHECK_RELEASE, CHECK_KEY_A },
+		{ 5.100, CHECK_PRESS, CHECK_KEY_S },
+		{ 5.100, CHECK_RELEASE, CHECK_KEY_S },
+		{ 5.100, CHECK_EXPECT, 1 },
+		{ 5.200, CHECK_PRESS, CHECK_KEY_A },
+		{ 5.200, CHECK_EXPECT, 0 },
+		{ 5.701, CHECK_EXPECT, 1 },
+	};
+
+	engine_init(&engine, 500);
+	engine_set_hysteresis(&engine, 0, 0, 3, 300);
+	check_script(&engine, "arm", steps, sizeof(steps) / sizeof(steps[0]));
+	check(engine.changes == 2, "arm", "expected 2 toggles", 0);
+}
+
+static void check_pause() {
+	Engine engine;
+	static const CheckStep steps[] = {
+		{ 1.000, CHECK_PRESS, CHECK_KEY_A },
+		{ 1.000, CHECK_EXPECT, 1 },
+		{ 1.200, CHECK_EXPECT, 1 },
+	};
+
+	engine_init(&engine, 500);
+	engine_pause(&engine, 1);
+	check_script(&engine, "pause", steps, sizeof(steps) / sizeof(steps[0]));
+	check(engine.changes == 0, "pause", "expected no toggles", 0);
+}
+
+/* Type count keys with intervals spread evenly around the given one by a
+ * fixed pseudo-random sequence, starting at the given time. Returns the
+ * time of the last key.
+ */
+static double check_type(Engine* engine, double time, int count, double interval,
+		unsigned int* seed) {
+	int i;
+	double deadline;
+
+	for (i = 0; i < count; i++) {
+		*seed = *seed * 1103515245 + 12345;
+		time += interval * (0.9 + 0.2 * ((*seed >> 16) & 0x7fff) / 32767.0);
+		engine_key_event(engine, 1, CHECK_KEY_A, time);
+		engine_key_event(engine, 0, CHECK_KEY_A, time);
+		engine_decide(engine, time, &deadline);
+	}
+	return time;
+}
+
+static void check_adaptive() {
+	Engine engine;
+	unsigned int seed = 1;
+	double time = CHECK_START;
+
+	engine_init(&engine, 1000);
+	engine_set_adaptive(&engine, 90, 100, 2000);
+
+	/* the fixed delay is kept until enough intervals are known */
+	time = check_type(&engine, time, 10, 0.2, &seed);
+	check(engine.idle_time == 1.0, "adaptive", "expected the fixed delay", time - CHECK_START);
+
+	/* steady typing settles just above its intervals */
+	time = check_type(&engine, time, 500, 0.2, &seed);
+	check(engine.idle_time >= 0.2 && engine.idle_time < 0.26, "adaptive",
+		"expected a delay just above 200 ms", time - CHECK_START);
+
+	/* faster typing takes over as the old intervals decay, down to the minimum */
+	time = check_type(&engine, time, 2000, 0.05, &seed);
+	check(engine.idle_time == 0.1, "adaptive", "expected the minimum delay",
+		time - CHECK_START);
+
+	/* long pauses are capped at the maximum */
+	time = check_type(&engine, time, 2000, 5.0, &seed);
+	check(engine.idle_time == 2.0, "adaptive", "expected the maximum delay",
+		time - CHECK_START);
+
+	engine_set_adaptive(&engine, 0, 100, 2000);
+	check(engine.idle_time == 1.0, "adaptive", "expected the fixed delay again",
+		time - CHECK_START);
+}
+
+static void check_keymap() {
+	Engine engine;
+	double deadline;
+	unsigned char keymap[MTRACKD_KEYMAP_SIZE] = { 0 };
+
+	engine_init(&engine, 500);
+	engine_set_modifier_key(&engine, CHECK_KEY_SHIFT);
+
+	keymap[CHECK_KEY_SHIFT / 8] |= 1 << (CHECK_KEY_SHIFT % 8);
+	check(!engine_keymap(&engine, keymap, CHECK_START + 1.0), "keymap",
+		"modifier counted as typing", 1.0);
+	keymap[CHECK_KEY_A / 8] |= 1 << (CHECK_KEY_A % 8);
+	check(engine_keymap(&engine, keymap, CHECK_START + 1.1), "keymap",
+		"new key not counted as typing", 1.1);
+	check(!engine_keymap(&engine, keymap, CHECK_START + 1.2), "keymap",
+		"held key counted as typing", 1.2);
+	check(!engine_decide(&engine, CHECK_START + 1.2, &deadline), "keymap",
+		"expected disabled", 1.2);
+	check(engine_decide(&engine, CHECK_START + 1.601, &deadline), "keymap",
+		"expected enabled", 1.601);
+}
+
+int main() {
+	check_delay();
+	check_modifiers();
+	check_hold();
+	check_arm();
+	check_pause();
+	check_adaptive();
+	check_keymap();
+
+	printf("%d checks, %d failed\n", check_count, check_failures);
+	return check_failures > 0 ? 1 : 0;
+}
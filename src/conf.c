@@ -21,9 +21,11 @@
 
 #include "conf.h"
 #include "common.h"
+#include "engine.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -31,7 +33,9 @@
 
 static void usage() {
 	fprintf(stderr, "Usage: dispad [-hmFD] [-c file] [-p name] [-e value] [-d value]\n");
-	fprintf(stderr, "            [-s time] [-i time] [-P file]\n");
+	fprintf(stderr, "            [-b backend] [-s time] [-i time] [-P file] [-S file]\n");
+	fprintf(stderr, "            [-u socket] [-x displays] [-M mechanism] [-C file]\n");
+	fprintf(stderr, "            [-T file] [-LB] [-l target]\n");
 }
 
 static void help() {
@@ -49,11 +53,31 @@ static void help() {
 	fprintf(stderr, "                            an 8-bit unsigned integer.\n");
 	fprintf(stderr, "  -m, --modifiers           Also disable the trackpads when modifier keys are\n");
 	fprintf(stderr, "                            pressed.\n");
+	fprintf(stderr, "  -b, --backend=NAME        How to detect keystrokes: auto, xinput2, evdev or\n");
+	fprintf(stderr, "                            poll. Defaults to auto.\n");
 	fprintf(stderr, "  -s, --poll=MS             How long (in ms) to sleep between keyboard polls.\n");
 	fprintf(stderr, "  -i, --delay=MS            How long (in ms) to disable the trackpad after a\n");
 	fprintf(stderr, "                            keystroke.\n");
 	fprintf(stderr, "  -P, --pidfile=FILE        Create a pid file at the given location. Only\n");
 	fprintf(stderr, "                            useful when daemonizing.\n");
+	fprintf(stderr, "  -S, --statsfile=FILE      Append statistics as JSON to the given file on\n");
+	fprintf(stderr, "                            SIGUSR1 and on exit.\n");
+	fprintf(stderr, "  -C, --cachefile=FILE      Remember which devices have the property in the\n");
+	fprintf(stderr, "                            given file. Defaults to ~/%s.\n", MTRACKD_DEFAULT_CACHE_FILE);
+	fprintf(stderr, "  -u, --socket=FILE         Accept control commands on a Unix socket at the\n");
+	fprintf(stderr, "                            given location.\n");
+	fprintf(stderr, "  -M, --mechanism=NAME      How to disable trackpads: property or uinput.\n");
+	fprintf(stderr, "                            Defaults to property.\n");
+	fprintf(stderr, "  -x, --displays=LIST       Serve every X display in a comma separated list\n");
+	fprintf(stderr, "                            from one process. Defaults to $DISPLAY.\n");
+	fprintf(stderr, "  -T, --tracefile=FILE      Record keystrokes and decisions into a ring buffer\n");
+	fprintf(stderr, "                            in the given file for dispad-replay.\n");
+	fprintf(stderr, "  -L, --lowjitter           Lock memory and apply the rtpriority and cpu\n");
+	fprintf(stderr, "                            settings to keep latency low under load.\n");
+	fprintf(stderr, "  -B, --strictbudget        Exit with status 3 if an idle tick or a toggle\n");
+	fprintf(stderr, "                            went over its request budget.\n");
+	fprintf(stderr, "  -l, --log=TARGET          Where to log: stderr, syslog or a file. Logging\n");
+	fprintf(stderr, "                            to syslog or a file continues when daemonized.\n");
 	fprintf(stderr, "  -F, --foreground          Start in the foreground. We daemonize by default.\n");
 	fprintf(stderr, "  -D, --debug               Enable debug output. Only useful when combined with\n");
 	fprintf(stderr, "                            -F.\n");
@@ -67,16 +91,32 @@ static Bool file_exists(char* file) {
 	return False;
 }
 
-static char* config_file_default() {
+static char* config_home_file(char* name) {
 	char* home = getenv("HOME");
-	char* file = malloc(strlen(home) + strlen(MTRACKD_DEFAULT_CONF) + 2);
+	char* file = malloc(strlen(home) + strlen(name) + 2);
 	strcpy(file, "");
 	strcat(file, home);
 	strcat(file, "/");
-	strcat(file, MTRACKD_DEFAULT_CONF);
+	strcat(file, name);
 	return file;
 }
 
+/* Return True if a display list names more than one display, split the way
+ * seats are.
+ */
+static Bool config_many_displays(char* list) {
+	if (list == NULL)
+		return False;
+	list += strspn(list, ", \t");
+	list += strcspn(list, ", \t");
+	list += strspn(list, ", \t");
+	return *list != '\0';
+}
+
+static char* config_file_default() {
+	return config_home_file(MTRACKD_DEFAULT_CONF);
+}
+
 static Bool config_file_create(char* file) {
 	FILE* fd = fopen(file, "w");
 	if (fd == NULL)
@@ -89,34 +129,201 @@ static Bool config_file_create(char* file) {
 	fprintf(fd, "enable = %d\n\n", MTRACKD_DEFAULT_ENABLE);
 	fprintf(fd, "# the value used to disable the trackpad\n");
 	fprintf(fd, "disable = %d\n\n", MTRACKD_DEFAULT_DISABLE);
+	fprintf(fd, "# fall back on the mtrack, synaptics, libinput and \"Device Enabled\" properties\n");
+	fprintf(fd, "# for touchpads without the property above\n");
+	fprintf(fd, "profiles = %s\n\n", MTRACKD_DEFAULT_PROFILES ? "true" : "false");
 	fprintf(fd, "# whether or not modifier keys disable the trackpad\n");
 	fprintf(fd, "modifiers = %s\n\n", MTRACKD_DEFAULT_MODIFIERS ? "true" : "false");
+	fprintf(fd, "# how to detect keystrokes: auto, xinput2, evdev or poll\n");
+	fprintf(fd, "backend = \"%s\"\n\n", MTRACKD_DEFAULT_BACKEND);
+	fprintf(fd, "# how to disable trackpads: property or uinput\n");
+	fprintf(fd, "mechanism = \"%s\"\n\n", MTRACKD_DEFAULT_MECHANISM);
+	fprintf(fd, "# write properties from a thread with its own X connection\n");
+	fprintf(fd, "controlthread = %s\n\n", MTRACKD_DEFAULT_CONTROL_THREAD ? "true" : "false");
+	fprintf(fd, "# comma separated X displays to serve from one process; $DISPLAY if left commented\n");
+	fprintf(fd, "#displays = \":0,:1\"\n\n");
 	fprintf(fd, "# how long (in ms) to sleep between keyboard polls\n");
 	fprintf(fd, "poll = %d\n\n", MTRACKD_DEFAULT_POLL);
+	fprintf(fd, "# the longest (in ms) to sleep between keyboard polls while idle\n");
+	fprintf(fd, "pollmax = %d\n\n", MTRACKD_DEFAULT_POLL_MAX);
+	fprintf(fd, "# the longest (in ms) to sleep between polls while on battery; 0 uses pollmax\n");
+	fprintf(fd, "pollbattery = %d\n\n", MTRACKD_DEFAULT_POLL_BATTERY);
 	fprintf(fd, "# how long (in ms) to disable the trackpad after a keystroke\n");
 	fprintf(fd, "delay = %d\n\n", MTRACKD_DEFAULT_DELAY);
+	fprintf(fd, "# learn the delay from this percentile of the pauses between keystrokes,\n");
+	fprintf(fd, "# kept between delaymin and delaymax ms; 0 always uses the delay above\n");
+	fprintf(fd, "adaptive = %d\n", MTRACKD_DEFAULT_ADAPTIVE);
+	fprintf(fd, "delaymin = %d\n", MTRACKD_DEFAULT_DELAY_MIN);
+	fprintf(fd, "delaymax = %d\n\n", MTRACKD_DEFAULT_DELAY_MAX);
+	fprintf(fd, "# the shortest time (in ms) the trackpad stays disabled once disabled\n");
+	fprintf(fd, "holddisabled = %d\n\n", MTRACKD_DEFAULT_HOLD_DISABLED);
+	fprintf(fd, "# the shortest time (in ms) the trackpad stays enabled once enabled\n");
+	fprintf(fd, "holdenabled = %d\n\n", MTRACKD_DEFAULT_HOLD_ENABLED);
+	fprintf(fd, "# only disable after this many keystrokes within armwindow ms\n");
+	fprintf(fd, "armkeys = %d\n", MTRACKD_DEFAULT_ARM_KEYS);
+	fprintf(fd, "armwindow = %d\n\n", MTRACKD_DEFAULT_ARM_WINDOW);
+	fprintf(fd, "# warn when an idle tick or a toggle makes more X requests than this; 0 is unlimited\n");
+	fprintf(fd, "tickbudget = %d\n", MTRACKD_DEFAULT_TICK_BUDGET);
+	fprintf(fd, "togglebudget = %d\n", MTRACKD_DEFAULT_TOGGLE_BUDGET);
+	fprintf(fd, "# exit with status 3 if a tick or a toggle went over its budget\n");
+	fprintf(fd, "strictbudget = %s\n\n", MTRACKD_DEFAULT_STRICT_BUDGET ? "true" : "false");
 	fprintf(fd, "# create a pid file at the given location; not created if left commented\n");
-	fprintf(fd, "#pidfile = \"%s/.dispad.pid\"\n", getenv("HOME"));
+	fprintf(fd, "#pidfile = \"%s/.dispad.pid\"\n\n", getenv("HOME"));
+	fprintf(fd, "# append statistics as JSON to this file on SIGUSR1 and on exit\n");
+	fprintf(fd, "#statsfile = \"%s/.dispad.stats\"\n\n", getenv("HOME"));
+	fprintf(fd, "# remember which devices have the property here; an empty string disables it\n");
+	fprintf(fd, "#cachefile = \"%s/%s\"\n\n", getenv("HOME"), MTRACKD_DEFAULT_CACHE_FILE);
+	fprintf(fd, "# accept control commands on a unix socket at the given location\n");
+	fprintf(fd, "#socket = \"%s/.dispad.sock\"\n\n", getenv("HOME"));
+	fprintf(fd, "# record keystrokes and decisions for dispad-replay, keeping the last tracesize records\n");
+	fprintf(fd, "#tracefile = \"%s/.dispad.trace\"\n", getenv("HOME"));
+	fprintf(fd, "tracesize = %d\n\n", MTRACKD_DEFAULT_TRACE_SIZE);
+	fprintf(fd, "# lock memory and use the settings below to keep latency low under load\n");
+	fprintf(fd, "lowjitter = %s\n", MTRACKD_DEFAULT_LOW_JITTER ? "true" : "false");
+	fprintf(fd, "# real-time policy (fifo or rr) and priority in low jitter mode; 0 keeps the\n");
+	fprintf(fd, "# normal scheduler\n");
+	fprintf(fd, "rtpolicy = \"%s\"\n", MTRACKD_DEFAULT_RT_POLICY);
+	fprintf(fd, "rtpriority = %d\n", MTRACKD_DEFAULT_RT_PRIORITY);
+	fprintf(fd, "# the cpu to run on in low jitter mode; -1 runs on any\n");
+	fprintf(fd, "cpu = %d\n\n", MTRACKD_DEFAULT_CPU);
+	fprintf(fd, "# where to log: stderr, syslog or a file, which also log when daemonized\n");
+	fprintf(fd, "log = \"%s\"\n", MTRACKD_DEFAULT_LOG);
 	fclose(fd);
 	return True;
 }
 
 static Bool config_file_parse(Config* obj, char* file) {
 	cfg_bool_t modifiers = obj->modifiers ? cfg_true : cfg_false;
+	cfg_bool_t low_jitter = obj->low_jitter ? cfg_true : cfg_false;
+	cfg_bool_t strict_budget = obj->strict_budget ? cfg_true : cfg_false;
+	cfg_bool_t profiles = obj->profiles ? cfg_true : cfg_false;
+	cfg_bool_t control_thread = obj->control_thread ? cfg_true : cfg_false;
+	long enable = obj->enable;
+	long disable = obj->disable;
+	long poll = obj->poll;
+	long poll_max = obj->poll_max;
+	long poll_battery = obj->poll_battery;
+	long delay = obj->delay;
+	long adaptive = obj->adaptive;
+	long delay_min = obj->delay_min;
+	long delay_max = obj->delay_max;
+	long hold_disabled = obj->hold_disabled;
+	long hold_enabled = obj->hold_enabled;
+	long arm_keys = obj->arm_keys;
+	long arm_window = obj->arm_window;
+	long trace_size = obj->trace_size;
+	long tick_budget = obj->tick_budget;
+	long toggle_budget = obj->toggle_budget;
+	long rt_priority = obj->rt_priority;
+	long cpu = obj->cpu;
 	cfg_opt_t opts[] = {
 		CFG_SIMPLE_STR("property", &obj->property),
-		CFG_SIMPLE_INT("enable", &obj->enable),
-		CFG_SIMPLE_INT("disable", &obj->disable),
+		CFG_SIMPLE_INT("enable", &enable),
+		CFG_SIMPLE_INT("disable", &disable),
+		CFG_SIMPLE_BOOL("profiles", &profiles),
 		CFG_SIMPLE_BOOL("modifiers", &modifiers),
-		CFG_SIMPLE_INT("poll", &obj->poll),
-		CFG_SIMPLE_INT("delay", &obj->delay),
+		CFG_SIMPLE_STR("backend", &obj->backend),
+		CFG_SIMPLE_STR("mechanism", &obj->mechanism),
+		CFG_SIMPLE_BOOL("controlthread", &control_thread),
+		CFG_SIMPLE_STR("displays", &obj->displays),
+		CFG_SIMPLE_INT("poll", &poll),
+		CFG_SIMPLE_INT("pollmax", &poll_max),
+		CFG_SIMPLE_INT("pollbattery", &poll_battery),
+		CFG_SIMPLE_INT("delay", &delay),
+		CFG_SIMPLE_INT("adaptive", &adaptive),
+		CFG_SIMPLE_INT("delaymin", &delay_min),
+		CFG_SIMPLE_INT("delaymax", &delay_max),
+		CFG_SIMPLE_INT("holddisabled", &hold_disabled),
+		CFG_SIMPLE_INT("holdenabled", &hold_enabled),
+		CFG_SIMPLE_INT("armkeys", &arm_keys),
+		CFG_SIMPLE_INT("armwindow", &arm_window),
+		CFG_SIMPLE_INT("tickbudget", &tick_budget),
+		CFG_SIMPLE_INT("togglebudget", &toggle_budget),
+		CFG_SIMPLE_BOOL("strictbudget", &strict_budget),
 		CFG_SIMPLE_STR("pidfile", &obj->pid_file),
+		CFG_SIMPLE_STR("statsfile", &obj->stats_file),
+		CFG_SIMPLE_STR("cachefile", &obj->cache_file),
+		CFG_SIMPLE_STR("socket", &obj->socket),
+		CFG_SIMPLE_STR("tracefile", &obj->trace_file),
+		CFG_SIMPLE_INT("tracesize", &trace_size),
+		CFG_SIMPLE_BOOL("lowjitter", &low_jitter),
+		CFG_SIMPLE_STR("rtpolicy", &obj->rt_policy),
+		CFG_SIMPLE_INT("rtpriority", &rt_priority),
+		CFG_SIMPLE_INT("cpu", &cpu),
+		CFG_SIMPLE_STR("log", &obj->log),
 		CFG_END()
 	};
 	cfg_t* cfg = cfg_init(opts, 0);
 	int res = cfg_parse(cfg, file);
 	cfg_free(cfg);
 	if (res == CFG_SUCCESS) {
+		if (enable < 0 || enable > 255 || disable < 0 || disable > 255) {
+			ERROR("enable and disable values must be between 0 and 255\n");
+			return False;
+		}
+		if (poll <= 0 || delay <= 0) {
+			ERROR("poll and delay must be greater than zero\n");
+			return False;
+		}
+		if (poll_max < 0 || poll_battery < 0) {
+			ERROR("poll limits must not be negative\n");
+			return False;
+		}
+		if (adaptive < 0 || adaptive > 99) {
+			ERROR("adaptive must be a percentile between 0 and 99\n");
+			return False;
+		}
+		if (delay_min <= 0 || delay_max < delay_min) {
+			ERROR("delaymin must be greater than zero and at most delaymax\n");
+			return False;
+		}
+		if (hold_disabled < 0 || hold_enabled < 0 || arm_window < 0) {
+			ERROR("hold times and the arm window must not be negative\n");
+			return False;
+		}
+		if (arm_keys < 1 || arm_keys > MTRACKD_ENGINE_MAX_KEYS) {
+			ERROR("armkeys must be between 1 and %d\n", MTRACKD_ENGINE_MAX_KEYS);
+			return False;
+		}
+		if (tick_budget < 0 || toggle_budget < 0) {
+			ERROR("request budgets must not be negative\n");
+			return False;
+		}
+		if (rt_priority < 0 || rt_priority > 99) {
+			ERROR("rtpriority must be between 0 and 99\n");
+			return False;
+		}
+		if (cpu < -1) {
+			ERROR("cpu must be -1 or a cpu number\n");
+			return False;
+		}
+		if (trace_size <= 0 || trace_size > UINT32_MAX / 2) {
+			ERROR("tracesize must be greater than zero\n");
+			return False;
+		}
+		obj->enable = enable;
+		obj->disable = disable;
+		obj->modifiers = modifiers == cfg_true;
+		obj->profiles = profiles == cfg_true;
+		obj->control_thread = control_thread == cfg_true;
+		obj->poll = poll;
+		obj->poll_max = poll_max;
+		obj->poll_battery = poll_battery;
+		obj->delay = delay;
+		obj->adaptive = adaptive;
+		obj->delay_min = delay_min;
+		obj->delay_max = delay_max;
+		obj->hold_disabled = hold_disabled;
+		obj->hold_enabled = hold_enabled;
+		obj->arm_keys = arm_keys;
+		obj->arm_window = arm_window;
+		obj->trace_size = trace_size;
+		obj->tick_budget = tick_budget;
+		obj->toggle_budget = toggle_budget;
+		obj->strict_budget = strict_budget == cfg_true;
+		obj->low_jitter = low_jitter == cfg_true;
+		obj->rt_priority = rt_priority;
+		obj->cpu = cpu;
 		return True;
 	}
 	else if (res == CFG_FILE_ERROR) {
@@ -128,20 +335,34 @@ static Bool config_file_parse(Config* obj, char* file) {
 	return False;
 }
 
-Bool config_init(Config* obj, int argc, char** argv) {
+/* Parse the commandline and the config file into obj. Commandline options
+ * override the config file. When reloading, a missing config file is an error
+ * rather than being created.
+ */
+static Bool config_load(Config* obj, int argc, char** argv, Bool reload) {
 	int c;
 	Bool res = True;
 	char* file = NULL;
-	char* opts = "c:p:e:d:ms:i:P:FDh";
+	char* opts = "c:p:e:d:mb:s:i:P:S:C:u:x:M:T:LBl:FDh";
 	struct option lopts[] = {
 		{"config", 1, 0, 'c'},
 		{"property", 1, 0, 'p'},
 		{"enable", 1, 0, 'e'},
 		{"disable", 1, 0, 'd'},
 		{"modifiers", 0, 0, 'm'},
+		{"backend", 1, 0, 'b'},
 		{"poll", 1, 0, 's'},
 		{"delay", 1, 0, 'i'},
 		{"pidfile", 1, 0, 'P'},
+		{"statsfile", 1, 0, 'S'},
+		{"cachefile", 1, 0, 'C'},
+		{"socket", 1, 0, 'u'},
+		{"displays", 1, 0, 'x'},
+		{"mechanism", 1, 0, 'M'},
+		{"tracefile", 1, 0, 'T'},
+		{"lowjitter", 0, 0, 'L'},
+		{"strictbudget", 0, 0, 'B'},
+		{"log", 1, 0, 'l'},
 		{"foreground", 0, 0, 'F'},
 		{"debug", 0, 0, 'D'},
 		{"help", 0, 0, 'h'},
@@ -153,25 +374,66 @@ Bool config_init(Config* obj, int argc, char** argv) {
 	Bool has_enable = False;
 	Bool has_disable = False;
 	Bool has_modifiers = False;
+	Bool has_backend = False;
 	Bool has_poll = False;
 	Bool has_delay = False;
 	Bool has_pid_file = False;
+	Bool has_stats_file = False;
+	Bool has_cache_file = False;
+	Bool has_socket = False;
+	Bool has_displays = False;
+	Bool has_mechanism = False;
+	Bool has_trace_file = False;
+	Bool has_low_jitter = False;
+	Bool has_strict_budget = False;
+	Bool has_log = False;
 	Bool has_fg = False;
 	Bool has_debug = False;
 
-	tmp.property = NULL;
-	tmp.pid_file = NULL;
+	memset(&tmp, 0, sizeof(tmp));
 	obj->pid_file_created = False;
+	obj->file = NULL;
+	obj->argc = argc;
+	obj->argv = argv;
 	obj->property = NULL;
+	obj->backend = NULL;
+	obj->displays = NULL;
+	obj->mechanism = NULL;
+	obj->rt_policy = NULL;
+	obj->log = NULL;
 	obj->enable = MTRACKD_DEFAULT_ENABLE;
 	obj->disable = MTRACKD_DEFAULT_DISABLE;
 	obj->modifiers = MTRACKD_DEFAULT_MODIFIERS;
+	obj->profiles = MTRACKD_DEFAULT_PROFILES;
+	obj->control_thread = MTRACKD_DEFAULT_CONTROL_THREAD;
 	obj->poll = MTRACKD_DEFAULT_POLL;
+	obj->poll_max = MTRACKD_DEFAULT_POLL_MAX;
+	obj->poll_battery = MTRACKD_DEFAULT_POLL_BATTERY;
 	obj->delay = MTRACKD_DEFAULT_DELAY;
+	obj->adaptive = MTRACKD_DEFAULT_ADAPTIVE;
+	obj->delay_min = MTRACKD_DEFAULT_DELAY_MIN;
+	obj->delay_max = MTRACKD_DEFAULT_DELAY_MAX;
+	obj->hold_disabled = MTRACKD_DEFAULT_HOLD_DISABLED;
+	obj->hold_enabled = MTRACKD_DEFAULT_HOLD_ENABLED;
+	obj->arm_keys = MTRACKD_DEFAULT_ARM_KEYS;
+	obj->arm_window = MTRACKD_DEFAULT_ARM_WINDOW;
+	obj->tick_budget = MTRACKD_DEFAULT_TICK_BUDGET;
+	obj->toggle_budget = MTRACKD_DEFAULT_TOGGLE_BUDGET;
+	obj->strict_budget = MTRACKD_DEFAULT_STRICT_BUDGET;
 	obj->pid_file = NULL;
+	obj->stats_file = NULL;
+	obj->cache_file = NULL;
+	obj->socket = NULL;
+	obj->trace_file = NULL;
+	obj->trace_size = MTRACKD_DEFAULT_TRACE_SIZE;
+	obj->low_jitter = MTRACKD_DEFAULT_LOW_JITTER;
+	obj->rt_priority = MTRACKD_DEFAULT_RT_PRIORITY;
+	obj->cpu = MTRACKD_DEFAULT_CPU;
 	obj->foreground = MTRACKD_DEFAULT_FG;
 	obj->debug = MTRACKD_DEFAULT_DEBUG;
 
+	/* start over when parsing the same arguments again */
+	optind = 0;
 	while ((c = getopt_long(argc, argv, opts, lopts, NULL)) != -1) {
 		switch (c) {
 		case 'c':
@@ -200,6 +462,17 @@ Bool config_init(Config* obj, int argc, char** argv) {
 			tmp.modifiers = True;
 			has_modifiers = True;
 			break;
+		case 'b':
+			if (strlen(optarg) > 0) {
+				tmp.backend = strdup(optarg);
+				has_backend = True;
+			}
+			else {
+				ERROR("backend name is empty\n");
+				res = False;
+				goto cleanup;
+			}
+			break;
 		case 's':
 			tmp.poll = atoi(optarg);
 			if (tmp.poll <= 0) {
@@ -212,7 +485,7 @@ Bool config_init(Config* obj, int argc, char** argv) {
 		case 'i':
 			tmp.delay = atoi(optarg);
 			if (tmp.delay <= 0) {
-				ERROR("invalid poll value: %s\n", optarg);
+				ERROR("invalid delay value: %s\n", optarg);
 				res = False;
 				goto cleanup;
 			}
@@ -229,6 +502,84 @@ Bool config_init(Config* obj, int argc, char** argv) {
 				goto cleanup;
 			}
 			break;
+		case 'S':
+			if (strlen(optarg) > 0) {
+				tmp.stats_file = strdup(optarg);
+				has_stats_file = True;
+			}
+			else {
+				ERROR("stats file is empty\n");
+				res = False;
+				goto cleanup;
+			}
+			break;
+		case 'C':
+			tmp.cache_file = strdup(optarg);
+			has_cache_file = True;
+			break;
+		case 'u':
+			if (strlen(optarg) > 0) {
+				tmp.socket = strdup(optarg);
+				has_socket = True;
+			}
+			else {
+				ERROR("socket path is empty\n");
+				res = False;
+				goto cleanup;
+			}
+			break;
+		case 'x':
+			if (strlen(optarg) > 0) {
+				tmp.displays = strdup(optarg);
+				has_displays = True;
+			}
+			else {
+				ERROR("display list is empty\n");
+				res = False;
+				goto cleanup;
+			}
+			break;
+		case 'M':
+			if (strcmp(optarg, "property") == 0 || strcmp(optarg, "uinput") == 0) {
+				tmp.mechanism = strdup(optarg);
+				has_mechanism = True;
+			}
+			else {
+				ERROR("unknown mechanism: %s\n", optarg);
+				res = False;
+				goto cleanup;
+			}
+			break;
+		case 'T':
+			if (strlen(optarg) > 0) {
+				tmp.trace_file = strdup(optarg);
+				has_trace_file = True;
+			}
+			else {
+				ERROR("trace file is empty\n");
+				res = False;
+				goto cleanup;
+			}
+			break;
+		case 'L':
+			tmp.low_jitter = True;
+			has_low_jitter = True;
+			break;
+		case 'B':
+			tmp.strict_budget = True;
+			has_strict_budget = True;
+			break;
+		case 'l':
+			if (strlen(optarg) > 0) {
+				tmp.log = strdup(optarg);
+				has_log = True;
+			}
+			else {
+				ERROR("log target is empty\n");
+				res = False;
+				goto cleanup;
+			}
+			break;
 		case 'F':
 			tmp.foreground = True;
 			has_fg = True;
@@ -252,7 +603,7 @@ Bool config_init(Config* obj, int argc, char** argv) {
 
 	if (file == NULL) {
 		file = config_file_default();
-		if (!file_exists(file)) {
+		if (!reload && !file_exists(file)) {
 			if (!config_file_create(file)) {
 				ERROR("failed to create default config file: %s\n", file);
 				res = False;
@@ -261,7 +612,8 @@ Bool config_init(Config* obj, int argc, char** argv) {
 		}
 	}
 	
-	INFO("using config file: %s\n", file);
+	INFO("%s config file: %s\n", reload ? "reloading" : "using", file);
+	obj->file = strdup(file);
 	if (!config_file_parse(obj, file)) {
 		ERROR("failed to parse config file: %s\n", file);
 		res = False;
@@ -276,6 +628,77 @@ Bool config_init(Config* obj, int argc, char** argv) {
 	else if (obj->property == NULL && MTRACKD_DEFAULT_PROP != NULL)
 		obj->property = strdup(MTRACKD_DEFAULT_PROP);
 
+	if (has_backend) {
+		if (obj->backend != NULL)
+			free(obj->backend);
+		obj->backend = strdup(tmp.backend);
+	}
+	else if (obj->backend == NULL)
+		obj->backend = strdup(MTRACKD_DEFAULT_BACKEND);
+
+	if (has_mechanism) {
+		if (obj->mechanism != NULL)
+			free(obj->mechanism);
+		obj->mechanism = strdup(tmp.mechanism);
+	}
+	else if (obj->mechanism == NULL)
+		obj->mechanism = strdup(MTRACKD_DEFAULT_MECHANISM);
+	else if (strcmp(obj->mechanism, "property") != 0 && strcmp(obj->mechanism, "uinput") != 0) {
+		ERROR("unknown mechanism: %s\n", obj->mechanism);
+		res = False;
+		goto cleanup;
+	}
+
+	if (obj->rt_policy == NULL)
+		obj->rt_policy = strdup(MTRACKD_DEFAULT_RT_POLICY);
+	else if (strcmp(obj->rt_policy, "fifo") != 0 && strcmp(obj->rt_policy, "rr") != 0) {
+		ERROR("unknown rtpolicy: %s\n", obj->rt_policy);
+		res = False;
+		goto cleanup;
+	}
+
+#ifndef HAVE_XSETIOERROREXITHANDLER
+	/* without it Xlib exits the process when a thread loses its display */
+	if (obj->control_thread) {
+		WARN("controlthread needs libX11 1.7 or newer and is disabled\n");
+		obj->control_thread = False;
+	}
+#endif
+
+	if (has_log) {
+		if (obj->log != NULL)
+			free(obj->log);
+		obj->log = strdup(tmp.log);
+	}
+	else if (obj->log == NULL || strlen(obj->log) == 0) {
+		if (obj->log != NULL)
+			free(obj->log);
+		obj->log = strdup(MTRACKD_DEFAULT_LOG);
+	}
+
+	if (has_displays) {
+		if (obj->displays != NULL)
+			free(obj->displays);
+		obj->displays = strdup(tmp.displays);
+	}
+	else if (obj->displays == NULL && MTRACKD_DEFAULT_DISPLAYS != NULL)
+		obj->displays = MTRACKD_DEFAULT_DISPLAYS;
+
+	/* a single proxy holds every touchpad, so seats would fight over it */
+	if (strcmp(obj->mechanism, "uinput") == 0 && config_many_displays(obj->displays)) {
+		ERROR("the uinput mechanism cannot serve more than one display\n");
+		res = False;
+		goto cleanup;
+	}
+
+	/* evdev reads every keyboard on the machine, so each seat would react to
+	 * the keystrokes of all the others */
+	if (strcmp(obj->backend, "evdev") == 0 && config_many_displays(obj->displays)) {
+		ERROR("the evdev backend cannot serve more than one display\n");
+		res = False;
+		goto cleanup;
+	}
+
 	if (has_pid_file) {
 		if (obj->pid_file != NULL)
 			free(obj->pid_file);
@@ -284,6 +707,42 @@ Bool config_init(Config* obj, int argc, char** argv) {
 	else if (obj->pid_file == NULL && MTRACKD_DEFAULT_PID_FILE != NULL)
 		obj->pid_file = MTRACKD_DEFAULT_PID_FILE;
 
+	if (has_stats_file) {
+		if (obj->stats_file != NULL)
+			free(obj->stats_file);
+		obj->stats_file = strdup(tmp.stats_file);
+	}
+	else if (obj->stats_file == NULL && MTRACKD_DEFAULT_STATS_FILE != NULL)
+		obj->stats_file = MTRACKD_DEFAULT_STATS_FILE;
+
+	if (has_cache_file) {
+		if (obj->cache_file != NULL)
+			free(obj->cache_file);
+		obj->cache_file = strdup(tmp.cache_file);
+	}
+	else if (obj->cache_file == NULL)
+		obj->cache_file = config_home_file(MTRACKD_DEFAULT_CACHE_FILE);
+	if (strlen(obj->cache_file) == 0) {
+		free(obj->cache_file);
+		obj->cache_file = NULL;
+	}
+
+	if (has_socket) {
+		if (obj->socket != NULL)
+			free(obj->socket);
+		obj->socket = strdup(tmp.socket);
+	}
+	else if (obj->socket == NULL && MTRACKD_DEFAULT_SOCKET != NULL)
+		obj->socket = MTRACKD_DEFAULT_SOCKET;
+
+	if (has_trace_file) {
+		if (obj->trace_file != NULL)
+			free(obj->trace_file);
+		obj->trace_file = strdup(tmp.trace_file);
+	}
+	else if (obj->trace_file == NULL && MTRACKD_DEFAULT_TRACE_FILE != NULL)
+		obj->trace_file = MTRACKD_DEFAULT_TRACE_FILE;
+
 	if (has_enable)
 		obj->enable = tmp.enable;
 	if (has_disable)
@@ -294,6 +753,10 @@ Bool config_init(Config* obj, int argc, char** argv) {
 		obj->poll = tmp.poll;
 	if (has_delay)
 		obj->delay = tmp.delay;
+	if (has_low_jitter)
+		obj->low_jitter = tmp.low_jitter;
+	if (has_strict_budget)
+		obj->strict_budget = tmp.strict_budget;
 	if (has_fg)
 		obj->foreground = tmp.foreground;
 	if (has_debug)
@@ -304,9 +767,88 @@ cleanup:
 		free(file);
 	if (tmp.property != NULL)
 		free(tmp.property);
+	if (tmp.backend != NULL)
+		free(tmp.backend);
+	if (tmp.displays != NULL)
+		free(tmp.displays);
+	if (tmp.mechanism != NULL)
+		free(tmp.mechanism);
+	if (tmp.pid_file != NULL)
+		free(tmp.pid_file);
+	if (tmp.stats_file != NULL)
+		free(tmp.stats_file);
+	if (tmp.cache_file != NULL)
+		free(tmp.cache_file);
+	if (tmp.socket != NULL)
+		free(tmp.socket);
+	if (tmp.trace_file != NULL)
+		free(tmp.trace_file);
+	if (tmp.log != NULL)
+		free(tmp.log);
 	return res;
 }
 
+Bool config_init(Config* obj, int argc, char** argv) {
+	return config_load(obj, argc, argv, False);
+}
+
+Bool config_reload(Config* obj, Config* next) {
+	if (!config_load(next, obj->argc, obj->argv, True)) {
+		config_free(next);
+		return False;
+	}
+	return True;
+}
+
+int config_watch(Config* obj) {
+	int fd;
+	char* dir;
+	char* slash;
+
+	if (obj->file == NULL)
+		return -1;
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	/* Editors often replace the file instead of writing to it, which a watch
+	 * on the file itself would not survive, so the directory is watched. */
+	dir = strdup(obj->file);
+	slash = strrchr(dir, '/');
+	if (slash == NULL)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		slash[1] = '\0';
+	else
+		slash[0] = '\0';
+
+	if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	free(dir);
+	return fd;
+}
+
+Bool config_changed(Config* obj, int fd) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event* ev;
+	ssize_t len;
+	char* ptr;
+	char* name = strrchr(obj->file, '/');
+	Bool changed = False;
+
+	name = name == NULL ? obj->file : name + 1;
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ev->len) {
+			ev = (struct inotify_event*)ptr;
+			if (ev->len > 0 && strcmp(ev->name, name) == 0)
+				changed = True;
+		}
+	}
+	return changed;
+}
+
 int config_create_pid_file(Config* obj) {
 	if (obj->pid_file == NULL)
 		return True;
@@ -343,9 +885,29 @@ int config_remove_pid_file(Config* obj) {
 }
 
 void config_free(Config* obj) {
+	if (obj->file != NULL)
+		free(obj->file);
 	if (obj->property != NULL)
 		free(obj->property);
+	if (obj->backend != NULL)
+		free(obj->backend);
+	if (obj->displays != NULL)
+		free(obj->displays);
+	if (obj->mechanism != NULL)
+		free(obj->mechanism);
 	if (obj->pid_file != NULL)
 		free(obj->pid_file);
+	if (obj->stats_file != NULL)
+		free(obj->stats_file);
+	if (obj->cache_file != NULL)
+		free(obj->cache_file);
+	if (obj->socket != NULL)
+		free(obj->socket);
+	if (obj->trace_file != NULL)
+		free(obj->trace_file);
+	if (obj->rt_policy != NULL)
+		free(obj->rt_policy);
+	if (obj->log != NULL)
+		free(obj->log);
 }
 
@@ -21,142 +21,1208 @@
 
 #include "control.h"
 #include "common.h"
+#include "stats.h"
+#include "trace.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <X11/extensions/XInput2.h>
 
-#define CONTROL_FIND_SLEEP 2
+#define CONTROL_RETRY_MIN 1.0
+#define CONTROL_RETRY_MAX 32.0
+#define CONTROL_MIN_CAPACITY 4
+#define CONTROL_CACHE_LINE 512
+#define CONTROL_CACHE_SKIP -2
+#define CONTROL_PROFILE_GENERIC 4
 
-static Bool control_get_value(Control* obj, int device_index, unsigned char* value) {
+static const ControlProfile control_profiles[MTRACKD_PROFILE_COUNT] = {
+	{ "configured", NULL, 1, 0, 0 },
+	{ "mtrack", "Trackpad Disable Input", 1, 0, 1 },
+	{ "synaptics", "Synaptics Off", 1, 0, 1 },
+	{ "libinput", "libinput Send Events Mode Enabled", 2, 0, 1 },
+	{ "generic", "Device Enabled", 1, 1, 0 },
+};
+
+/* The object whose thread is running, NULL on every other thread.
+ */
+static __thread Control* control_current = NULL;
+
+/* Take the lock against the thread. If the thread died holding it along with
+ * its display, the lock is taken over.
+ */
+static void control_lock(Control* obj) {
+	if (pthread_mutex_lock(&obj->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&obj->lock);
+	if (control_current != obj && obj->held++ == 0)
+		obj->owner = pthread_self();
+}
+
+/* Release the lock. Requests made meanwhile may have read events from the
+ * connection, which the thread would not wake up for on its own.
+ */
+static void control_unlock(Control* obj) {
+	if (control_current != obj)
+		obj->held--;
+	pthread_mutex_unlock(&obj->lock);
+	if (obj->threaded && control_current != obj)
+		queue_wake(&obj->queue);
+}
+
+/* Return the value of the toggled element which enables or disables a
+ * device under its profile.
+ */
+static unsigned char control_profile_value(Control* obj, ControlDevice* dev, int enable) {
+	if (dev->profile == MTRACKD_PROFILE_CONFIGURED)
+		return enable ? obj->enable_value : obj->disable_value;
+	return enable ? control_profiles[dev->profile].enable : control_profiles[dev->profile].disable;
+}
+
+/* Read the property of a device's profile. The elements are packed into value
+ * with the toggled one in the lowest byte.
+ */
+static Bool control_get_value(Control* obj, ControlDevice* dev, unsigned int* value) {
 	Atom type;
-	int format;
+	int i, format;
 	unsigned long size, bytes;
 	unsigned char* data;
+	int res;
+	double start = now();
+	const ControlProfile* profile = &control_profiles[dev->profile];
 
-	if (XGetDeviceProperty(obj->display, obj->devices[device_index], obj->property, 0, 1,
-			False, XA_INTEGER, &type, &format, &size, &bytes, &data) == Success &&
-			type != None) {
-		*value = data[0];
-		free(data);
-		return True;
+	dev->serial = NextRequest(obj->display);
+	res = XGetDeviceProperty(obj->display, dev->device, obj->profile_atoms[dev->profile], 0,
+			profile->values, False, XA_INTEGER, &type, &format, &size, &bytes, &data);
+	stats_record(&stats.get, now() - start);
+
+	if (res != Success || type == None)
+		return False;
+	if (format != 8 || size < 1) {
+		XFree(data);
+		return False;
 	}
-	return False;
+	*value = 0;
+	for (i = 0; i < profile->values && (unsigned long)i < size; i++)
+		*value |= data[i] << (8 * i);
+	XFree(data);
+	return True;
 }
 
-static void control_set_value(Control* obj, int device_index, unsigned char value) {
-	XChangeDeviceProperty(obj->display, obj->devices[device_index],
-		obj->property, XA_INTEGER, 8, PropModeReplace, &value, 1);
+/* Write the toggled element of a device's property. The other elements are
+ * written back as the device started with them.
+ */
+static void control_set_value(Control* obj, ControlDevice* dev, unsigned char value) {
+	int i;
+	unsigned char data[MTRACKD_PROFILE_MAX_VALUES];
+	const ControlProfile* profile = &control_profiles[dev->profile];
+
+	data[0] = value;
+	for (i = 1; i < profile->values; i++)
+		data[i] = (dev->start_value >> (8 * i)) & 0xff;
+	dev->serial = NextRequest(obj->display);
+	XChangeDeviceProperty(obj->display, dev->device, obj->profile_atoms[dev->profile],
+		XA_INTEGER, 8, PropModeReplace, data, profile->values);
+	dev->pending_writes++;
 }
 
-static int control_load_devices(Control* obj) {
-	int i;
-	int ndev = 0;
+/* Choose the profile for a device from its property list: the configured
+ * property if present, otherwise the first built-in profile it supports.
+ * Returns -1 if there is none.
+ */
+static int control_match_profile(Control* obj, Atom* properties, int nprops) {
+	int i, p;
+	int best = -1;
+	int count = obj->profiles ? MTRACKD_PROFILE_COUNT : 1;
+
+	for (i = 0; i < nprops; i++) {
+		for (p = 0; p < count && (best == -1 || p < best); p++) {
+			if (obj->profile_atoms[p] != None && properties[i] == obj->profile_atoms[p])
+				best = p;
+		}
+	}
+	return best;
+}
+
+/* Find the profile of an opened device and read its start value. Lists the
+ * device's properties once and reads the one chosen. Returns False if the
+ * device cannot be toggled.
+ */
+static Bool control_probe(Control* obj, ControlDevice* probe, const char* name,
+		unsigned int* value) {
 	int nprops = 0;
-	unsigned char value;
-	Atom touchpad_type = XInternAtom(obj->display, XI_TOUCHPAD, True);
-	Atom* properties = NULL;
-	XDevice* dev = NULL;
-	XDeviceInfo* info = XListInputDevices(obj->display, &ndev);
+	Atom* properties = XListDeviceProperties(obj->display, probe->device, &nprops);
 
-	obj->device_count = 0;
-	DEBUG("searching %d devices for %s\n", ndev, obj->property_name);
-
-	while (ndev--) {
-		if (info[ndev].type == touchpad_type) {
-			DEBUG("found touchpad device %s\n", info[ndev].name);
-			dev = XOpenDevice(obj->display, info[ndev].id);
-			if (!dev) {
-				WARN("failed to open device %s\n", info[ndev].name);
-				continue;
+	probe->profile = properties ? control_match_profile(obj, properties, nprops) : -1;
+	if (properties)
+		XFree(properties);
+	else
+		DEBUG("no properties on device %s\n", name);
+	if (probe->profile == -1)
+		return False;
+
+	DEBUG("using the %s profile for device %s\n", control_profiles[probe->profile].name, name);
+	return control_get_value(obj, probe, value);
+}
+
+/* Ask for property change notifications on a device so the cached state can
+ * be invalidated when another client changes it.
+ */
+static void control_select_events(Control* obj, ControlDevice* dev) {
+	XEventClass cls;
+	DevicePropertyNotify(dev->device, obj->property_notify_type, cls);
+	XSelectExtensionEvent(obj->display, DefaultRootWindow(obj->display), &cls, 1);
+}
+
+/* Look up a managed device by its XInput device id in constant time. Returns
+ * NULL if the device is not managed.
+ */
+static ControlDevice* control_lookup(Control* obj, XID id) {
+	if (id >= (XID)obj->device_index_size || obj->device_index[id] == -1)
+		return NULL;
+	return &obj->devices[obj->device_index[id]];
+}
+
+/* Append a device to the table, growing the table and the id index as
+ * needed. Returns NULL if memory could not be allocated.
+ */
+static ControlDevice* control_append(Control* obj, XDevice* device, int profile,
+		unsigned int value) {
+	int i, size;
+	int* index;
+	ControlDevice* devices;
+	ControlDevice* dev;
+
+	if (device->device_id >= (XID)obj->device_index_size) {
+		size = obj->device_index_size > 0 ? obj->device_index_size : CONTROL_MIN_CAPACITY;
+		while ((XID)size <= device->device_id)
+			size *= 2;
+		index = realloc(obj->device_index, size * sizeof(int));
+		if (index == NULL)
+			return NULL;
+		for (i = obj->device_index_size; i < size; i++)
+			index[i] = -1;
+		obj->device_index = index;
+		obj->device_index_size = size;
+	}
+
+	if (obj->device_count == obj->device_capacity) {
+		size = obj->device_capacity > 0 ? obj->device_capacity * 2 : CONTROL_MIN_CAPACITY;
+		devices = realloc(obj->devices, size * sizeof(ControlDevice));
+		if (devices == NULL)
+			return NULL;
+		obj->devices = devices;
+		obj->device_capacity = size;
+	}
+
+	obj->device_index[device->device_id] = obj->device_count;
+	dev = &obj->devices[obj->device_count++];
+	dev->device = device;
+	dev->profile = profile;
+	dev->start_value = value;
+	dev->state = value & 0xff;
+	dev->pending_writes = 0;
+	dev->toggles = 0;
+	dev->lost = False;
+	dev->serial = NextRequest(obj->display);
+	control_select_events(obj, dev);
+	return dev;
+}
+
+/* Drop a device from the table by moving the last entry into its slot.
+ */
+static void control_drop(Control* obj, ControlDevice* dev) {
+	int index = dev - obj->devices;
+	ControlDevice* last = &obj->devices[--obj->device_count];
+
+	obj->device_index[dev->device->device_id] = -1;
+	if (dev != last) {
+		*dev = *last;
+		obj->device_index[dev->device->device_id] = index;
+	}
+}
+
+/* Forget all devices. With closing set the devices which still exist are
+ * closed on the server, otherwise they are only freed, for a server which may
+ * no longer know about them.
+ */
+static void control_clear(Control* obj, Bool closing) {
+	XDevice* device;
+	Bool exists;
+	while (obj->device_count > 0) {
+		device = obj->devices[0].device;
+		exists = closing && !obj->devices[0].lost;
+		control_drop(obj, &obj->devices[0]);
+		if (exists)
+			XCloseDevice(obj->display, device);
+		else
+			XFree(device);
+	}
+}
+
+/* Report how long it took from startup until the first device was managed.
+ */
+static void control_report_found(Control* obj) {
+	if (obj->found_reported || obj->device_count == 0)
+		return;
+	obj->found_reported = True;
+	DEBUG("first device managed %.1f ms after start\n", (now() - stats.start) * 1000.0);
+}
+
+/* Open a single device and manage it if it has a profile. Used for devices
+ * announced by hierarchy events.
+ */
+static void control_add_device(Control* obj, XID id) {
+	unsigned int value;
+	char name[32];
+	ControlDevice probe;
+
+	if (control_lookup(obj, id) != NULL)
+		return;
+
+	probe.device = XOpenDevice(obj->display, id);
+	if (!probe.device)
+		return;
+
+	snprintf(name, sizeof(name), "%lu", id);
+	if (!control_probe(obj, &probe, name, &value)) {
+		XCloseDevice(obj->display, probe.device);
+		return;
+	}
+
+	if (control_append(obj, probe.device, probe.profile, value) == NULL) {
+		ERROR("out of memory adding device %lu\n", id);
+		XCloseDevice(obj->display, probe.device);
+		return;
+	}
+	DEBUG("managing added device %lu\n", id);
+	control_toggle(obj, obj->enabled);
+	control_report_found(obj);
+}
+
+/* Stop managing a device. The device is only closed if it still exists on the
+ * server.
+ */
+static void control_remove_device(Control* obj, XID id, Bool exists) {
+	XDevice* device;
+	ControlDevice* dev = control_lookup(obj, id);
+	if (dev == NULL)
+		return;
+
+	DEBUG("device %lu is gone, %d devices remaining\n", id, obj->device_count - 1);
+	device = dev->device;
+	control_drop(obj, dev);
+	if (exists)
+		XCloseDevice(obj->display, device);
+	else
+		XFree(device);
+}
+
+/* Check whether a device was disabled by toggling its "Device Enabled"
+ * property, in which case it stays managed.
+ */
+static Bool control_disabled_by_us(Control* obj, XID id) {
+	ControlDevice* dev = control_lookup(obj, id);
+	return dev != NULL &&
+		obj->profile_atoms[dev->profile] == obj->profile_atoms[CONTROL_PROFILE_GENERIC] &&
+		(dev->pending_writes > 0 || dev->state == control_profile_value(obj, dev, False));
+}
+
+/* Return True if the device list has the given device as a touchpad.
+ */
+static Bool control_is_touchpad(Control* obj, XDeviceInfo* devices, int ndev, XID id) {
+	int i;
+	for (i = 0; i < ndev; i++) {
+		if (devices[i].id == id)
+			return devices[i].type == obj->touchpad_type;
+	}
+	return False;
+}
+
+static void control_hierarchy_event(Control* obj, XIHierarchyEvent* ev) {
+	int i, ndev = 0;
+	XIHierarchyInfo* info;
+	XDeviceInfo* devices = NULL;
+	Bool listed = False;
+
+	for (i = 0; i < ev->num_info; i++) {
+		info = &ev->info[i];
+		if (info->flags & XISlaveRemoved)
+			control_remove_device(obj, info->deviceid, False);
+		else if (info->flags & XIDeviceDisabled) {
+			if (!control_disabled_by_us(obj, info->deviceid))
+				control_remove_device(obj, info->deviceid, True);
+		}
+		else if (info->flags & (XISlaveAdded | XIDeviceEnabled) &&
+				info->use == XISlavePointer && info->enabled &&
+				control_lookup(obj, info->deviceid) == NULL) {
+			/* mice are slave pointers too, only touchpads are probed */
+			if (!listed) {
+				devices = XListInputDevices(obj->display, &ndev);
+				listed = True;
 			}
+			if (control_is_touchpad(obj, devices, ndev, info->deviceid))
+				control_add_device(obj, info->deviceid);
+		}
+	}
+	if (devices != NULL)
+		XFreeDeviceList(devices);
+}
+
+/* Subscribe to device hierarchy changes so devices can be added and removed
+ * as they come and go. Returns False if the server lacks XInput2.
+ */
+static Bool control_select_hierarchy(Control* obj) {
+	int event, error;
+	int major = 2, minor = 0;
+	unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+	XIEventMask mask;
+
+	if (!XQueryExtension(obj->display, "XInputExtension", &obj->xi_opcode, &event, &error) ||
+			XIQueryVersion(obj->display, &major, &minor) != Success)
+		return False;
+
+	memset(bits, 0, sizeof(bits));
+	XISetMask(bits, XI_HierarchyChanged);
+	mask.deviceid = XIAllDevices;
+	mask.mask_len = sizeof(bits);
+	mask.mask = bits;
+	XISelectEvents(obj->display, DefaultRootWindow(obj->display), &mask, 1);
+	return True;
+}
+
+/* Replace the cache entries for this display and property with the result
+ * of a probe. Each touchpad is recorded with its profile and start value, or
+ * -1 if it has no profile. Entries for other displays and properties are
+ * kept.
+ */
+static void control_save_cache(Control* obj, XDeviceInfo* info, int* profiles,
+		long* values, int ndev) {
+	int i;
+	FILE* in;
+	FILE* out;
+	char line[CONTROL_CACHE_LINE];
+	char* tmp;
+	char* display = DisplayString(obj->display);
+	size_t prefix_len = strlen(display) + strlen(obj->property_name) + 2;
+	char* prefix = malloc(prefix_len + 1);
+
+	tmp = malloc(strlen(obj->cache_file) + 5);
+	sprintf(tmp, "%s.tmp", obj->cache_file);
+	sprintf(prefix, "%s\t%s\t", display, obj->property_name);
+
+	out = fopen(tmp, "w");
+	if (out == NULL) {
+		DEBUG("could not write device cache: %s\n", tmp);
+		free(prefix);
+		free(tmp);
+		return;
+	}
+
+	in = fopen(obj->cache_file, "r");
+	if (in != NULL) {
+		while (fgets(line, sizeof(line), in) != NULL) {
+			if (strncmp(line, prefix, prefix_len) != 0)
+				fputs(line, out);
+		}
+		fclose(in);
+	}
+	for (i = 0; i < ndev; i++) {
+		if (values[i] != CONTROL_CACHE_SKIP)
+			fprintf(out, "%s%lu\t%s\t%ld\t%s\n", prefix, info[i].id,
+				profiles[i] >= 0 ? control_profiles[profiles[i]].name : "none",
+				values[i], info[i].name);
+	}
 
-			properties = XListDeviceProperties(obj->display, dev, &nprops);
-			if (properties) {
-				while (nprops--) {
-					if (properties[nprops] == obj->property) {
-						DEBUG("found property on device %s\n", info[ndev].name);
-						obj->devices[obj->device_count++] = dev;
-						break;
-					}
-				}
+	if (fclose(out) != 0 || rename(tmp, obj->cache_file) != 0) {
+		DEBUG("could not write device cache: %s\n", obj->cache_file);
+		unlink(tmp);
+	}
+	free(prefix);
+	free(tmp);
+}
+
+/* Return the index of a profile by name, or -1 for "none" or an unknown or
+ * unusable profile.
+ */
+static int control_profile_index(Control* obj, const char* name) {
+	int p;
+	for (p = 0; p < (obj->profiles ? MTRACKD_PROFILE_COUNT : 1); p++) {
+		if (strcmp(control_profiles[p].name, name) == 0 && obj->profile_atoms[p] != None)
+			return p;
+	}
+	return -1;
+}
+
+/* Look up a device in the cache. Returns True and sets the profile and start
+ * value, or a value of -1 for a device without a profile, if the cache has a
+ * usable entry for the device on this display and property.
+ */
+static Bool control_cache_lookup(Control* obj, FILE* cache, XDeviceInfo* info, int* profile,
+		long* value) {
+	char line[CONTROL_CACHE_LINE];
+	char* save = NULL;
+	char* display;
+	char* property;
+	char* id;
+	char* prof;
+	char* start;
+	char* name;
+
+	rewind(cache);
+	while (fgets(line, sizeof(line), cache) != NULL) {
+		display = strtok_r(line, "\t", &save);
+		property = strtok_r(NULL, "\t", &save);
+		id = strtok_r(NULL, "\t", &save);
+		prof = strtok_r(NULL, "\t", &save);
+		start = strtok_r(NULL, "\t", &save);
+		name = strtok_r(NULL, "\n", &save);
+		if (name == NULL || strcmp(display, DisplayString(obj->display)) != 0 ||
+				strcmp(property, obj->property_name) != 0)
+			continue;
+		if (strtoul(id, NULL, 10) == info->id && strcmp(name, info->name) == 0) {
+			*value = atol(start);
+			*profile = control_profile_index(obj, prof);
+			/* a profile which is no longer usable needs a new probe */
+			return *value < 0 || *profile >= 0;
+		}
+	}
+	return False;
+}
+
+/* Load devices from the cache. Every touchpad on the server must have a cache
+ * entry matching its id and name, otherwise nothing is loaded and False is
+ * returned so a full probe is done. Cached devices are opened without listing
+ * or reading their properties; a device which has since changed is caught by
+ * the usual BadDevice handling or by the next full probe.
+ */
+static Bool control_load_cached(Control* obj) {
+	int i, ndev = 0;
+	int profile;
+	long value;
+	Bool complete = True;
+	FILE* cache;
+	XDevice* device;
+	XDeviceInfo* info;
+	ControlDevice* dev;
+
+	if (obj->cache_file == NULL || (cache = fopen(obj->cache_file, "r")) == NULL)
+		return False;
+
+	info = XListInputDevices(obj->display, &ndev);
+	control_clear(obj, True);
+
+	for (i = 0; i < ndev && complete; i++) {
+		if (info[i].type != obj->touchpad_type)
+			continue;
+		if (!control_cache_lookup(obj, cache, &info[i], &profile, &value)) {
+			DEBUG("device %s is not cached\n", info[i].name);
+			complete = False;
+		}
+		else if (value >= 0) {
+			device = XOpenDevice(obj->display, info[i].id);
+			if (device == NULL)
+				complete = False;
+			else if ((dev = control_append(obj, device, profile, value)) == NULL) {
+				XCloseDevice(obj->display, device);
+				complete = False;
 			}
 			else {
-				DEBUG("no properties on device %s\n", info[ndev].name);
+				/* the cached value may be stale, so the first toggle writes */
+				dev->state = MTRACKD_STATE_UNKNOWN;
+				DEBUG("loaded cached device %s\n", info[i].name);
 			}
-			XFree(properties);
-
-			if (obj->device_count == 0 || obj->devices[obj->device_count-1] != dev)
-				XCloseDevice(obj->display, dev);
-		}
-		else {
-			DEBUG("not a trackpad: %s\n", info[ndev].name);
 		}
+	}
 
-		if (obj->device_count == MTRACKD_MAX_DEVICES)
-			break;
+	fclose(cache);
+	XFreeDeviceList(info);
+	if (!complete || obj->device_count == 0) {
+		control_clear(obj, True);
+		return False;
 	}
+	return True;
+}
 
-	for (i = 0; i < obj->device_count; i++) {
-		if (control_get_value(obj, i, &value))
-			obj->start_values[i] = value;
+static int control_load_devices(Control* obj) {
+	int i, ndev = 0;
+	unsigned int value;
+	ControlDevice probe;
+	XDeviceInfo* info = XListInputDevices(obj->display, &ndev);
+	int* profiles = malloc((ndev > 0 ? ndev : 1) * sizeof(int));
+	long* values = malloc((ndev > 0 ? ndev : 1) * sizeof(long));
+
+	if (profiles == NULL || values == NULL) {
+		ERROR("out of memory searching devices\n");
+		free(profiles);
+		free(values);
+		if (info != NULL)
+			XFreeDeviceList(info);
+		return obj->device_count;
 	}
 
+	control_clear(obj, True);
+	DEBUG("searching %d devices for %s%s\n", ndev, obj->property_name,
+		obj->profiles ? " or a built-in profile" : "");
+
+	for (i = ndev - 1; i >= 0; i--) {
+		values[i] = CONTROL_CACHE_SKIP;
+		profiles[i] = -1;
+		if (info[i].type == obj->touchpad_type) {
+			DEBUG("found touchpad device %s\n", info[i].name);
+			probe.device = XOpenDevice(obj->display, info[i].id);
+			if (!probe.device) {
+				WARN("failed to open device %s\n", info[i].name);
+				continue;
+			}
+
+			values[i] = -1;
+			if (control_probe(obj, &probe, info[i].name, &value) &&
+					control_append(obj, probe.device, probe.profile, value) != NULL) {
+				profiles[i] = probe.profile;
+				values[i] = value;
+				continue;
+			}
+			XCloseDevice(obj->display, probe.device);
+		}
+		else {
+			DEBUG("not a trackpad: %s\n", info[i].name);
+		}
+	}
+
+	if (obj->cache_file != NULL && obj->device_count > 0)
+		control_save_cache(obj, info, profiles, values, ndev);
+	free(profiles);
+	free(values);
 	XFreeDeviceList(info);
 	return obj->device_count;
 }
 
+void control_rescan(Control* obj) {
+	if (obj->proxy != NULL)
+		return;
+	control_lock(obj);
+	control_load_devices(obj);
+	DEBUG("rescan found %d controllable devices\n", obj->device_count);
+	control_toggle(obj, obj->enabled);
+	control_unlock(obj);
+}
+
+/* Arm the retry timer to fire after the given number of seconds, or as soon
+ * as possible if that is zero.
+ */
+static void control_schedule(Control* obj, double delay) {
+	struct itimerspec spec;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = (time_t)delay;
+	spec.it_value.tv_nsec = (long)((delay - spec.it_value.tv_sec) * 1000000000.0);
+	if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+		spec.it_value.tv_nsec = 1;
+	timerfd_settime(obj->retry_fd, 0, &spec, NULL);
+}
+
+/* Schedule the next rediscovery and double the delay of the one after.
+ */
+static void control_backoff(Control* obj) {
+	DEBUG("no controllable devices found, retrying in %.0f seconds\n", obj->retry_delay);
+	control_schedule(obj, obj->retry_delay);
+	obj->retry_delay *= 2;
+	if (obj->retry_delay > CONTROL_RETRY_MAX)
+		obj->retry_delay = CONTROL_RETRY_MAX;
+}
+
+static void control_search(Control* obj) {
+	if (control_load_cached(obj)) {
+		DEBUG("loaded %d controllable devices from the cache\n", obj->device_count);
+		control_toggle(obj, True);
+		control_report_found(obj);
+		return;
+	}
+	if (control_load_devices(obj)) {
+		DEBUG("found %d controllable devices\n", obj->device_count);
+		control_toggle(obj, True);
+		control_report_found(obj);
+		return;
+	}
+	if (obj->hotplug) {
+		DEBUG("no controllable devices found, waiting for one to be added\n");
+		return;
+	}
+	control_backoff(obj);
+}
+
 void control_find_devices(Control* obj) {
-	while (True) {
-		if (control_load_devices(obj)) {
-			DEBUG("found %d controllable devices\n", obj->device_count);
-			control_toggle(obj, True);
-			return;
+	if (obj->proxy != NULL)
+		return;
+	control_lock(obj);
+	control_search(obj);
+	control_unlock(obj);
+}
+
+Bool control_device_error(Control* obj, unsigned long serial, XID id) {
+	int i;
+	ControlDevice* dev = NULL;
+
+	for (i = 0; i < obj->device_count && dev == NULL; i++) {
+		if (obj->devices[i].serial == serial)
+			dev = &obj->devices[i];
+	}
+	if (dev == NULL)
+		dev = control_lookup(obj, id);
+	if (dev == NULL || obj->retry_fd < 0)
+		return False;
+
+	if (!dev->lost) {
+		DEBUG("device %lu is lost\n", dev->device->device_id);
+		dev->lost = True;
+		obj->devices_lost++;
+	}
+	control_schedule(obj, 0);
+	return True;
+}
+
+/* Forget the lost devices without talking to the server about them. Returns
+ * the number of devices dropped.
+ */
+static int control_drop_lost(Control* obj) {
+	int i = 0;
+	int dropped = 0;
+	XDevice* device;
+
+	while (i < obj->device_count) {
+		if (!obj->devices[i].lost) {
+			i++;
+			continue;
 		}
-		DEBUG("no controllable devices found, sleeping for %d seconds\n", CONTROL_FIND_SLEEP);
-		sleep(CONTROL_FIND_SLEEP);
+		/* the last device moves into this slot */
+		device = obj->devices[i].device;
+		control_drop(obj, &obj->devices[i]);
+		XFree(device);
+		dropped++;
+	}
+	return dropped;
+}
+
+/* Manage every touchpad which is not managed yet. Returns the number of
+ * devices added.
+ */
+static int control_discover(Control* obj) {
+	int i, ndev = 0;
+	int count = obj->device_count;
+	XDeviceInfo* info = XListInputDevices(obj->display, &ndev);
+
+	for (i = 0; i < ndev; i++) {
+		if (info[i].type == obj->touchpad_type && control_lookup(obj, info[i].id) == NULL)
+			control_add_device(obj, info[i].id);
 	}
+	if (info != NULL)
+		XFreeDeviceList(info);
+	return obj->device_count - count;
+}
+
+int control_retry_fd(Control* obj) {
+	return obj->threaded ? -1 : obj->retry_fd;
+}
+
+void control_retry(Control* obj) {
+	uint64_t expirations;
+	int dropped, found;
+
+	if (read(obj->retry_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	control_lock(obj);
+	dropped = control_drop_lost(obj);
+	if (dropped > 0)
+		WARN("dropped %d lost devices, %d devices remaining\n", dropped, obj->device_count);
+	found = control_discover(obj);
+	if (found > 0)
+		DEBUG("rediscovered %d devices\n", found);
+
+	/* hierarchy events announce devices which come back later */
+	if (found > 0 || obj->hotplug)
+		obj->retry_delay = CONTROL_RETRY_MIN;
+	else
+		control_backoff(obj);
+	control_unlock(obj);
+}
+
+/* Look up the touchpad type and the property of every profile in a single
+ * round trip. Properties the server does not know are None.
+ */
+static void control_intern_atoms(Control* obj) {
+	int i;
+	char* names[MTRACKD_PROFILE_COUNT + 1];
+	Atom atoms[MTRACKD_PROFILE_COUNT + 1];
+
+	names[0] = XI_TOUCHPAD;
+	names[1] = obj->property_name;
+	for (i = 1; i < MTRACKD_PROFILE_COUNT; i++)
+		names[i + 1] = (char*)control_profiles[i].property;
+	if (!XInternAtoms(obj->display, names, MTRACKD_PROFILE_COUNT + 1, True, atoms)) {
+		/* atoms which do not exist are reported as a failure too */
+		DEBUG("not all profile properties exist on display %s\n", DisplayString(obj->display));
+	}
+
+	obj->touchpad_type = atoms[0];
+	for (i = 0; i < MTRACKD_PROFILE_COUNT; i++)
+		obj->profile_atoms[i] = atoms[i + 1];
+	obj->property = obj->profile_atoms[MTRACKD_PROFILE_CONFIGURED];
+}
+
+/* Check whether any profile in use has a property on the server.
+ */
+static Bool control_has_profile(Control* obj) {
+	int p;
+	for (p = 0; p < (obj->profiles ? MTRACKD_PROFILE_COUNT : 1); p++) {
+		if (obj->profile_atoms[p] != None)
+			return True;
+	}
+	return False;
+}
+
+/* The lock is recursive, since the error handler may rescan while a write
+ * holds it, and robust, so a thread which lost its display cannot leave it
+ * held.
+ */
+static Bool control_init_lock(Control* obj) {
+	int res;
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	res = pthread_mutex_init(&obj->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	return res == 0;
 }
 
 Bool control_init(Control* obj, Display* display, char* property_name,
-		int enable_value, int disable_value) {
+		int enable_value, int disable_value, Bool profiles, Proxy* proxy) {
 	obj->property_name = strdup(property_name);
 	obj->enable_value = enable_value;
 	obj->disable_value = disable_value;
 	obj->display = display;
-	obj->property = XInternAtom(obj->display, property_name, True);
+	obj->devices = NULL;
+	obj->device_count = 0;
+	obj->device_capacity = 0;
+	obj->device_index = NULL;
+	obj->device_index_size = 0;
+	obj->property_notify_type = -1;
+	obj->enabled = True;
+	obj->hotplug = False;
+	obj->proxy = proxy;
+	obj->cache_file = NULL;
+	obj->found_reported = False;
+	obj->profiles = profiles;
+	obj->threaded = False;
+	obj->stopping = 0;
+	obj->display_lost = 0;
+	obj->requested = True;
+	obj->lost_fd = -1;
+	obj->retry_fd = -1;
+	obj->retry_delay = CONTROL_RETRY_MIN;
+	obj->devices_lost = 0;
+	obj->held = 0;
+	obj->queue.fd = -1;
+	if (!control_init_lock(obj)) {
+		ERROR("failed to initialize control lock\n");
+		free(obj->property_name);
+		XCloseDisplay(obj->display);
+		return False;
+	}
+
+	/* the proxy works below the X server, so no devices are managed here */
+	if (obj->proxy != NULL)
+		return True;
 
-	if (obj->property == 0) {
+	control_intern_atoms(obj);
+	if (!control_has_profile(obj)) {
 		ERROR("property not found: %s\n", obj->property_name);
 		XCloseDisplay(obj->display);
 		return False;
 	}
+	if (obj->property == None)
+		DEBUG("property %s not found, using built-in profiles only\n", obj->property_name);
+
+	obj->hotplug = control_select_hierarchy(obj);
+	if (!obj->hotplug)
+		DEBUG("xinput2 unavailable, devices will not be hotplugged\n");
 
+	obj->retry_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (obj->retry_fd < 0) {
+		ERROR("failed to create retry timer: %s\n", strerror(errno));
+		free(obj->property_name);
+		pthread_mutex_destroy(&obj->lock);
+		XCloseDisplay(obj->display);
+		return False;
+	}
 	return True;
 }
 
+static Bool control_change(Control* obj, char* property_name, int enable_value,
+		int disable_value) {
+	int i;
+	Atom property;
+
+	if (obj->proxy != NULL) {
+		free(obj->property_name);
+		obj->property_name = strdup(property_name);
+		obj->enable_value = enable_value;
+		obj->disable_value = disable_value;
+		return True;
+	}
+
+	if (strcmp(property_name, obj->property_name) != 0) {
+		property = XInternAtom(obj->display, property_name, True);
+		if (property == None && !obj->profiles) {
+			ERROR("property not found: %s\n", property_name);
+			return False;
+		}
+
+		/* hand the old property back before moving to the new one */
+		for (i = 0; i < obj->device_count; i++) {
+			if (!obj->devices[i].lost)
+				control_set_value(obj, &obj->devices[i], obj->devices[i].start_value & 0xff);
+		}
+		free(obj->property_name);
+		obj->property_name = strdup(property_name);
+		obj->property = property;
+		obj->profile_atoms[MTRACKD_PROFILE_CONFIGURED] = property;
+		obj->enable_value = enable_value;
+		obj->disable_value = disable_value;
+		control_rescan(obj);
+		return True;
+	}
+
+	if ((unsigned int)enable_value != obj->enable_value ||
+			(unsigned int)disable_value != obj->disable_value) {
+		obj->enable_value = enable_value;
+		obj->disable_value = disable_value;
+		for (i = 0; i < obj->device_count; i++) {
+			if (obj->devices[i].profile == MTRACKD_PROFILE_CONFIGURED)
+				obj->devices[i].state = MTRACKD_STATE_UNKNOWN;
+		}
+		control_toggle(obj, obj->enabled);
+	}
+	return True;
+}
+
+Bool control_configure(Control* obj, char* property_name, int enable_value,
+		int disable_value) {
+	Bool res;
+	control_lock(obj);
+	res = control_change(obj, property_name, enable_value, disable_value);
+	control_unlock(obj);
+	return res;
+}
+
+void control_set_cache(Control* obj, char* file) {
+	if (obj->cache_file != NULL)
+		free(obj->cache_file);
+	obj->cache_file = file == NULL ? NULL : strdup(file);
+}
+
+/* Stop the thread and wait for it to exit, unless it already has.
+ */
+static void control_stop_thread(Control* obj) {
+	if (!obj->threaded)
+		return;
+	__atomic_store_n(&obj->stopping, 1, __ATOMIC_RELEASE);
+	queue_wake(&obj->queue);
+	pthread_join(obj->thread, NULL);
+	obj->threaded = False;
+	queue_free(&obj->queue);
+	close(obj->lost_fd);
+	obj->lost_fd = -1;
+}
+
 void control_free(Control* obj) {
 	int i;
+	control_stop_thread(obj);
 	for (i = 0; i < obj->device_count; i++) {
-		control_set_value(obj, i, obj->start_values[i]);
-		XCloseDevice(obj->display, obj->devices[i]);
+		if (obj->devices[i].lost) {
+			XFree(obj->devices[i].device);
+			continue;
+		}
+		control_set_value(obj, &obj->devices[i], obj->devices[i].start_value & 0xff);
+		XCloseDevice(obj->display, obj->devices[i].device);
 	}
+	free(obj->devices);
+	free(obj->device_index);
 	free(obj->property_name);
+	free(obj->cache_file);
+	if (obj->retry_fd >= 0)
+		close(obj->retry_fd);
+	pthread_mutex_destroy(&obj->lock);
+}
+
+void control_discard(Control* obj) {
+	/* a lost display may have jumped out of a call holding the lock, which
+	 * only happens without a thread, on the thread which jumped */
+	while (obj->held > 0 && pthread_equal(obj->owner, pthread_self())) {
+		obj->held--;
+		pthread_mutex_unlock(&obj->lock);
+	}
+	control_stop_thread(obj);
+	control_clear(obj, False);
+	free(obj->devices);
+	free(obj->device_index);
+	free(obj->property_name);
+	free(obj->cache_file);
+	if (obj->retry_fd >= 0)
+		close(obj->retry_fd);
+	pthread_mutex_destroy(&obj->lock);
 }
 
 void control_toggle(Control* obj, int enable) {
 	int i;
-	unsigned char current_value;
-	unsigned char new_value = enable ? obj->enable_value : obj->disable_value;
+	int writes = 0;
+	double start = now();
+	unsigned long request = NextRequest(obj->display);
+	ControlDevice* dev;
+	unsigned char new_value;
+
+	obj->enabled = enable;
 
+	if (obj->proxy != NULL) {
+		if (proxy_toggle(obj->proxy, enable)) {
+			stats_record(&stats.set, now() - start);
+			trace_record(&trace, MTRACKD_TRACE_WRITE, start, obj->proxy->device_count);
+		}
+		return;
+	}
+
+	/* Property writes have no reply, so every device is written in one batch
+	 * and flushed once. A device in an unknown state is simply written again
+	 * rather than read back first. */
 	for (i = 0; i < obj->device_count; i++) {
-		if (control_get_value(obj, i, &current_value)) {
-			if (current_value != new_value) {
-				DEBUG("setting state to %u for device at index %d\n", new_value, i);
-				control_set_value(obj, i, new_value);
-			}
+		dev = &obj->devices[i];
+		new_value = control_profile_value(obj, dev, enable);
+		if (!dev->lost && dev->state != new_value) {
+			DEBUG("setting state to %u for device %lu\n", new_value, dev->device->device_id);
+			control_set_value(obj, dev, new_value);
+			dev->state = new_value;
+			dev->toggles++;
+			writes++;
 		}
-		else
-			DEBUG("could not get current value of property %s\n", obj->property_name);
 	}
+
+	if (writes > 0) {
+		request = NextRequest(obj->display) - request;
+		if (!stats_requests(&stats.toggle, request, 0))
+			WARN("toggling display %s took %lu requests, over the budget of %lu\n",
+				DisplayString(obj->display), request, stats.toggle.budget);
+		XFlush(obj->display);
+		stats_record(&stats.set, now() - start);
+		trace_record(&trace, MTRACKD_TRACE_WRITE, start, writes);
+	}
+}
+
+Bool control_handle_event(Control* obj, XEvent* event) {
+	ControlDevice* dev;
+	XDevicePropertyNotifyEvent* ev;
+	XGenericEventCookie* cookie = &event->xcookie;
+
+	if (obj->hotplug && cookie->type == GenericEvent && cookie->extension == obj->xi_opcode &&
+			cookie->evtype == XI_HierarchyChanged && cookie->data != NULL) {
+		control_hierarchy_event(obj, cookie->data);
+		return True;
+	}
+
+	if (obj->property_notify_type == -1 || event->type != obj->property_notify_type)
+		return False;
+
+	ev = (XDevicePropertyNotifyEvent*)event;
+	dev = control_lookup(obj, ev->deviceid);
+	if (dev == NULL || ev->atom != obj->profile_atoms[dev->profile])
+		return True;
+
+	/* notifications for our own writes arrive in order */
+	if (dev->pending_writes > 0)
+		dev->pending_writes--;
+	else {
+		DEBUG("property changed externally on device %lu\n", ev->deviceid);
+		dev->state = MTRACKD_STATE_UNKNOWN;
+	}
+	return True;
+}
+
+static void control_read_events(Control* obj) {
+	XEvent ev;
+
+	while (XPending(obj->display)) {
+		XNextEvent(obj->display, &ev);
+		if (ev.type == GenericEvent && !XGetEventData(obj->display, &ev.xcookie))
+			ev.xcookie.data = NULL;
+		control_handle_event(obj, &ev);
+		if (ev.type == GenericEvent && ev.xcookie.data != NULL)
+			XFreeEventData(obj->display, &ev.xcookie);
+	}
+}
+
+/* Apply the latest queued state and handle events until stopped. Rewriting
+ * the current state when nothing was queued repairs devices other clients
+ * changed, as the listener does without a thread.
+ */
+static void* control_thread_main(void* data) {
+	Control* obj = data;
+	struct pollfd fds[3];
+	QueueCommand command;
+	double time;
+	Bool idle;
+
+	control_current = obj;
+	fds[0].fd = queue_fd(&obj->queue);
+	fds[0].events = POLLIN;
+	fds[1].fd = ConnectionNumber(obj->display);
+	fds[1].events = POLLIN;
+	fds[2].fd = obj->retry_fd;
+	fds[2].events = POLLIN;
+	fds[2].revents = 0;
+
+	while (!__atomic_load_n(&obj->stopping, __ATOMIC_ACQUIRE)) {
+		if (fds[2].revents & POLLIN) {
+			fds[2].revents = 0;
+			control_retry(obj);
+		}
+		control_lock(obj);
+		/* Xlib keeps the display locked for whichever thread saw it fail */
+		if (control_display_lost(obj)) {
+			control_unlock(obj);
+			break;
+		}
+		queue_clear(&obj->queue);
+		control_read_events(obj);
+		time = 0;
+		while (queue_pop(&obj->queue, &command)) {
+			obj->enabled = command.enable;
+			time = command.time;
+		}
+		control_toggle(obj, obj->enabled);
+		if (time > 0)
+			stats_record(&stats.apply, now() - time);
+		/* a flush may have read events the socket no longer shows */
+		idle = XQLength(obj->display) == 0;
+		control_unlock(obj);
+
+		if (control_display_lost(obj))
+			break;
+		if (idle)
+			poll(fds, 3, -1);
+	}
+	return NULL;
+}
+
+#ifdef HAVE_XSETIOERROREXITHANDLER
+/* Xlib calls this after the I/O error handler returned for the thread's
+ * display. Returning makes the failed call return instead of exiting.
+ */
+static void control_io_error_exit(Display* display, void* data) {
+}
+#endif
+
+Bool control_start_thread(Control* obj) {
+	int res;
+	sigset_t all, old;
+	pthread_attr_t attr;
+
+	if (!queue_init(&obj->queue)) {
+		ERROR("failed to create control queue: %s\n", strerror(errno));
+		return False;
+	}
+	obj->lost_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (obj->lost_fd < 0) {
+		ERROR("failed to create control wakeup: %s\n", strerror(errno));
+		queue_free(&obj->queue);
+		return False;
+	}
+	obj->stopping = 0;
+	obj->display_lost = 0;
+	obj->requested = obj->enabled;
+	obj->threaded = True;
+#ifdef HAVE_XSETIOERROREXITHANDLER
+	XSetIOErrorExitHandler(obj->display, control_io_error_exit, obj);
+#endif
+
+	/* signals are handled by the main thread, never by the control thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, MTRACKD_CONTROL_STACK);
+	res = pthread_create(&obj->thread, &attr, control_thread_main, obj);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (res != 0) {
+		ERROR("failed to start control thread: %s\n", strerror(res));
+		obj->threaded = False;
+		queue_free(&obj->queue);
+		close(obj->lost_fd);
+		obj->lost_fd = -1;
+		return False;
+	}
+	DEBUG("control thread started on display %s\n", DisplayString(obj->display));
+	return True;
 }
 
+void control_request(Control* obj, int enable, double time) {
+	if (!obj->threaded) {
+		control_toggle(obj, enable);
+		return;
+	}
+	/* a full queue leaves the change to be retried by the next request */
+	if (enable != obj->requested && queue_push(&obj->queue, time, enable))
+		obj->requested = enable;
+}
+
+int control_lost_fd(Control* obj) {
+	return obj->threaded ? obj->lost_fd : -1;
+}
+
+Bool control_thread_lost(Control* obj) {
+	uint64_t one = 1;
+	if (!obj->threaded)
+		return False;
+	if (__atomic_exchange_n(&obj->display_lost, 1, __ATOMIC_ACQ_REL) == 0 &&
+			write(obj->lost_fd, &one, sizeof(one)) != sizeof(one))
+		ERROR("failed to report the lost control connection\n");
+	return True;
+}
+
+Bool control_display_lost(Control* obj) {
+	return __atomic_load_n(&obj->display_lost, __ATOMIC_ACQUIRE) != 0;
+}
+
+unsigned long control_toggles(Control* obj) {
+	int i;
+	unsigned long toggles = 0;
+	control_lock(obj);
+	for (i = 0; i < obj->device_count; i++)
+		toggles += obj->devices[i].toggles;
+	if (obj->proxy != NULL)
+		toggles += obj->proxy->toggles;
+	control_unlock(obj);
+	return toggles;
+}
+
+void control_dump(Control* obj, FILE* out) {
+	int i;
+	ControlDevice* dev;
+	if (obj->proxy != NULL)
+		proxy_dump(obj->proxy, out);
+	control_lock(obj);
+	for (i = 0; i < obj->device_count; i++) {
+		dev = &obj->devices[i];
+		fprintf(out, "[S] device %lu: %s, state %d, %lu toggles%s\n", dev->device->device_id,
+			control_profiles[dev->profile].name, dev->state, dev->toggles,
+			dev->lost ? ", lost" : "");
+	}
+	if (obj->devices_lost > 0)
+		fprintf(out, "[S] %lu devices lost\n", obj->devices_lost);
+	control_unlock(obj);
+}
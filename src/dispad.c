@@ -19,39 +19,135 @@
  *
  **************************************************************************/
 
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/signalfd.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/XI.h>
 #include "common.h"
 #include "conf.h"
 #include "control.h"
 #include "listen.h"
+#include "log.h"
+#include "loop.h"
+#include "proxy.h"
+#include "realtime.h"
+#include "seat.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
 
 #define X11_ERROR_BUFFER 256
 
 int log_level = LOG_INFO;
-Display* display = NULL;
+Stats stats;
+Trace trace;
 Config* config = NULL;
-Control* control = NULL;
-Listen* listen = NULL;
+Seat* seats = NULL;
+int seat_count = 0;
+Loop* loop = NULL;
+Proxy* proxy = NULL;
+Server* server = NULL;
+int signal_fd = -1;
+int config_fd = -1;
+jmp_buf io_error_jump;
+Bool io_error_ready = False;
+Seat* io_error_seat = NULL;
+
+static unsigned long total_toggles() {
+	int i;
+	unsigned long toggles = 0;
+	for (i = 0; i < seat_count; i++) {
+		if (seats[i].active)
+			toggles += control_toggles(&seats[i].control);
+	}
+	return toggles;
+}
+
+static int active_seats() {
+	int i, count = 0;
+	for (i = 0; i < seat_count; i++) {
+		if (seats[i].active)
+			count++;
+	}
+	return count;
+}
+
+/* Append the statistics as a single line of JSON to the stats file, so runs
+ * with different settings or builds can be compared by a script.
+ */
+static void stats_save() {
+	FILE* f;
+	double uptime = now() - stats.start;
+
+	if (config->stats_file == NULL || loop == NULL || seats == NULL)
+		return;
+	f = fopen(config->stats_file, "a");
+	if (f == NULL) {
+		ERROR("could not write to stats file: %s\n", config->stats_file);
+		return;
+	}
+
+	fprintf(f, "{\"uptime\": %.3f, \"cpu\": %.6f, \"wakeups\": %lu, \"toggles\": %lu, "
+		"\"backend\": \"%s\", \"poll\": %d, \"delay\": %d, \"displays\": %d, "
+		"\"log_dropped\": %lu, ", uptime, stats_cpu_time(), loop->wakeups, total_toggles(),
+		config->backend, config->poll, config->delay, active_seats(), log_dropped());
+	stats_write(&stats, f);
+	fprintf(f, "}\n");
+	fclose(f);
+}
+
+static void stats_report() {
+	int i;
+	stats_dump(&stats, stderr, loop->wakeups);
+	fprintf(stderr, "[S] log: %lu messages dropped\n", log_dropped());
+	for (i = 0; i < seat_count; i++) {
+		if (seats[i].active)
+			seat_dump(&seats[i], stderr);
+	}
+	stats_save();
+}
 
 static void cleanup() {
-	if (control != NULL) {
-		control_free(control);
-		free(control);
-		control = NULL;
+	int i;
+	io_error_ready = False;
+	if (config != NULL)
+		stats_save();
+	if (server != NULL) {
+		server_free(server);
+		free(server);
+		server = NULL;
 	}
-	if (listen != NULL) {
-		free(listen);
-		listen = NULL;
+	if (seats != NULL) {
+		for (i = 0; i < seat_count; i++)
+			seat_close(&seats[i], loop);
+		free(seats);
+		seats = NULL;
+		seat_count = 0;
 	}
-	if (display != NULL) {
-		XCloseDisplay(display);
-		display = NULL;
+	if (proxy != NULL) {
+		loop_remove(loop, proxy_fd(proxy));
+		proxy_free(proxy);
+		free(proxy);
+		proxy = NULL;
+	}
+	trace_close(&trace);
+	if (loop != NULL) {
+		loop_free(loop);
+		free(loop);
+		loop = NULL;
+	}
+	if (signal_fd >= 0) {
+		close(signal_fd);
+		signal_fd = -1;
+	}
+	if (config_fd >= 0) {
+		close(config_fd);
+		config_fd = -1;
 	}
 	if (config != NULL) {
 		config_remove_pid_file(config);
@@ -59,47 +155,189 @@ static void cleanup() {
 		free(config);
 		config = NULL;
 	}
+	log_stop();
 }
 
+/* Runs on whichever thread made the failed request, so it makes no requests
+ * and leaves the seat to be dropped from the loop.
+ */
 int xlib_error_handler(Display* display, XErrorEvent* event) {
-	int xi_major, xi_event, xi_error;
+	Seat* seat;
 	char buffer[X11_ERROR_BUFFER];
 	strcpy(buffer, "");
 
-	if (!XQueryExtension(event->display, INAME, &xi_major, &xi_event, &xi_error)) {
-		ERROR("failed to query xinput extension\n");
-		cleanup();
-		exit(2);
-	}
-
 	XGetErrorText(event->display, event->error_code, buffer, X11_ERROR_BUFFER);
 
-	if (event->request_code == xi_major && event->error_code == xi_error + XI_BadDevice) {
+	/* a lost device is only marked here, it is dropped and looked for again
+	 * from the loop owning its connection without re-entering Xlib */
+	seat = seat_find(seats, seat_count, event->display);
+	if (seat == NULL) {
+		ERROR("%s\n", buffer);
+	}
+	else if (event->request_code == seat->xi_major &&
+			event->error_code == seat->xi_error + XI_BadDevice) {
 		WARN("%s\n", buffer);
-		control_find_devices(control);
+		if (!control_device_error(&seat->control, event->serial, event->resourceid))
+			DEBUG("request %lu was not made for a managed device\n", event->serial);
 	}
 	else {
-		ERROR("%s\n", buffer);
-		cleanup();
-		exit(2);
+		ERROR("%s, dropping display %s\n", buffer, seat->name);
+		seat_error(seat);
 	}
 
 	return 0;
 }
 
+/* Xlib exits when this returns, so a lost display jumps back to main, which
+ * drops the seat and keeps serving the other displays. Control threads have
+ * an exit handler on their display which lets the failed call return.
+ */
+int xlib_io_error_handler(Display* display) {
+	Seat* seat = seat_find(seats, seat_count, display);
+	/* the control connection is dropped through the loop instead, so a call
+	 * holding the control lock returns and releases it on either thread */
+	if (seat != NULL && display == seat->control_display && control_thread_lost(&seat->control))
+		return 0;
+	if (seat == NULL || !io_error_ready) {
+		ERROR("lost connection to the X server\n");
+		exit(2);
+	}
+	io_error_seat = seat;
+	longjmp(io_error_jump, 1);
+	return 0;
+}
+
+/* The control thread of a seat lost its connection, or an X error left the
+ * seat unusable, which drops the seat the same way as losing the listener's.
+ */
+static void control_lost(void* data, uint32_t events) {
+	io_error_seat = data;
+	longjmp(io_error_jump, 1);
+}
+
 static void signal_handler(int signum) {
 	cleanup();
 	exit(0);
 }
 
-static void signal_installer() {
-	int signals[] = { SIGHUP, SIGINT, SIGQUIT, SIGILL, SIGTRAP, SIGABRT,
-		SIGBUS, SIGFPE, SIGUSR1, SIGSEGV, SIGUSR2, SIGPIPE, SIGALRM, SIGTERM,
+static void signal_read(void* data, uint32_t events) {
+	struct signalfd_siginfo info;
+	if (read(signal_fd, &info, sizeof(info)) != sizeof(info))
+		return;
+	DEBUG("received signal %u\n", info.ssi_signo);
+	if (info.ssi_signo == SIGUSR1)
+		stats_report();
+	else
+		loop_stop(loop);
+}
+
+static Bool string_changed(char* a, char* b) {
+	if (a == NULL || b == NULL)
+		return a != b;
+	return strcmp(a, b) != 0;
+}
+
+static void string_swap(char** a, char** b) {
+	char* tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
+/* Parse the config file again and apply the settings which can change while
+ * running. The whole file is validated before anything is applied and this
+ * runs between loop iterations, so the listener never sees a partial update.
+ */
+static void config_apply() {
+	int i;
+	Config next;
+
+	if (!config_reload(config, &next)) {
+		WARN("keeping the running configuration\n");
+		return;
+	}
+	for (i = 0; i < seat_count; i++) {
+		if (!seats[i].active)
+			continue;
+		if (!control_configure(&seats[i].control, next.property, next.enable, next.disable))
+			WARN("display %s keeps the property %s\n", seats[i].name,
+				seats[i].control.property_name);
+		listen_configure(&seats[i].listen, next.modifiers, next.delay, next.poll,
+			next.poll_max, next.poll_battery);
+		listen_set_hysteresis(&seats[i].listen, next.hold_disabled, next.hold_enabled,
+			next.arm_keys, next.arm_window);
+		listen_set_adaptive(&seats[i].listen, next.adaptive, next.delay_min, next.delay_max);
+	}
+
+	stats.tick.budget = next.tick_budget;
+	stats.toggle.budget = next.toggle_budget;
+
+	if (string_changed(next.backend, config->backend))
+		WARN("changing the backend requires a restart\n");
+	if (string_changed(next.pid_file, config->pid_file))
+		WARN("changing the pid file requires a restart\n");
+	if (string_changed(next.cache_file, config->cache_file))
+		WARN("changing the cache file requires a restart\n");
+	if (string_changed(next.socket, config->socket))
+		WARN("changing the socket requires a restart\n");
+	if (string_changed(next.mechanism, config->mechanism))
+		WARN("changing the mechanism requires a restart\n");
+	if (string_changed(next.displays, config->displays))
+		WARN("changing the displays requires a restart\n");
+	if (next.low_jitter != config->low_jitter || next.rt_priority != config->rt_priority ||
+			next.cpu != config->cpu || string_changed(next.rt_policy, config->rt_policy))
+		WARN("changing the low jitter settings requires a restart\n");
+	if (next.profiles != config->profiles)
+		WARN("changing the profiles option requires a restart\n");
+	if (next.control_thread != config->control_thread)
+		WARN("changing the control thread option requires a restart\n");
+	if (string_changed(next.log, config->log))
+		WARN("changing the log target requires a restart\n");
+	if (string_changed(next.trace_file, config->trace_file) || next.trace_size != config->trace_size)
+		WARN("changing the trace file requires a restart\n");
+
+	/* settings which only take effect at startup keep their running value */
+	string_swap(&next.backend, &config->backend);
+	string_swap(&next.pid_file, &config->pid_file);
+	string_swap(&next.cache_file, &config->cache_file);
+	string_swap(&next.socket, &config->socket);
+	string_swap(&next.mechanism, &config->mechanism);
+	string_swap(&next.displays, &config->displays);
+	string_swap(&next.trace_file, &config->trace_file);
+	string_swap(&next.rt_policy, &config->rt_policy);
+	string_swap(&next.log, &config->log);
+	next.profiles = config->profiles;
+	next.control_thread = config->control_thread;
+	next.low_jitter = config->low_jitter;
+	next.rt_priority = config->rt_priority;
+	next.cpu = config->cpu;
+	next.trace_size = config->trace_size;
+	next.pid_file_created = config->pid_file_created;
+	next.foreground = config->foreground;
+	next.debug = config->debug;
+
+	config_free(config);
+	*config = next;
+	INFO("configuration reloaded\n");
+}
+
+static void config_read(void* data, uint32_t events) {
+	if (config_changed(config, config_fd))
+		config_apply();
+}
+
+static void proxy_handler(void* data, uint32_t events) {
+	proxy_read(data);
+}
+
+static int fault_signals[] = { SIGILL, SIGTRAP, SIGABRT, SIGBUS, SIGFPE, SIGSEGV };
+static int loop_signals[] = { SIGHUP, SIGINT, SIGQUIT, SIGUSR1, SIGUSR2, SIGPIPE,
+	SIGALRM, SIGTERM,
 #ifdef SIGPWR
-		SIGPWR
+	SIGPWR
 #endif
-    };
+};
 
+static void signal_installer() {
 	size_t i;
 	struct sigaction action;
 	sigset_t set;
@@ -113,14 +351,43 @@ static void signal_installer() {
 	action.sa_flags = 0;
 #endif
 
-	for (i = 0; i < sizeof(signals) / sizeof(int); i++) {
-		if (sigaction(signals[i], &action, NULL) == -1) {
+	for (i = 0; i < sizeof(fault_signals) / sizeof(int); i++) {
+		if (sigaction(fault_signals[i], &action, NULL) == -1) {
+			perror("sigaction");
+			exit(2);
+		}
+	}
+	for (i = 0; i < sizeof(loop_signals) / sizeof(int); i++) {
+		if (sigaction(loop_signals[i], &action, NULL) == -1) {
 			perror("sigaction");
 			exit(2);
 		}
 	}
 }
 
+/* Signals raised by a fault must be handled where they occur. The rest are
+ * redirected to a signalfd once the event loop is ready to handle them.
+ */
+static void signal_redirect() {
+	size_t i;
+	sigset_t set;
+
+	sigemptyset(&set);
+	for (i = 0; i < sizeof(loop_signals) / sizeof(int); i++)
+		sigaddset(&set, loop_signals[i]);
+	if (sigprocmask(SIG_BLOCK, &set, NULL) == -1) {
+		perror("sigprocmask");
+		exit(2);
+	}
+
+	signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd == -1 || !loop_add(loop, signal_fd, signal_read, NULL)) {
+		perror("signalfd");
+		cleanup();
+		exit(2);
+	}
+}
+
 void background() {
 	int pid = fork();
 	if (pid > 0) {
@@ -135,65 +402,175 @@ void background() {
 }
 
 int main(int argc, char** argv) {
+	int i, count;
+	char** names;
+	Bool strict;
+
+	stats_init(&stats);
+	trace_init(&trace);
 	config = malloc(sizeof(Config));
 	if (!config_init(config, argc, argv))
 		return 1;
+	stats.tick.budget = config->tick_budget;
+	stats.toggle.budget = config->toggle_budget;
 
-	if (config->foreground)
+	/* a daemon has no terminal to log to, but syslog or a file still work */
+	if (config->foreground || strcmp(config->log, "stderr") != 0)
 		log_level = config->debug ? LOG_DEBUG : LOG_INFO;
-	else {
+	else
 		log_level = LOG_NONE;
+	if (!config->foreground)
 		background();
+
+	/* the writer thread must be started after forking to survive it */
+	if (log_level != LOG_NONE && !log_start(config->log)) {
+		cleanup();
+		return 1;
 	}
 
 	INFO("configured with:\n");
 	INFO("  property = %s\n", config->property);
 	INFO("  enable = %u\n", config->enable);
 	INFO("  disable = %u\n", config->disable);
+	INFO("  profiles = %s\n", config->profiles ? "true" : "false");
 	INFO("  modifiers = %s\n", config->modifiers ? "true" : "false");
+	INFO("  backend = %s\n", config->backend);
+	INFO("  mechanism = %s\n", config->mechanism);
+	INFO("  controlthread = %s\n", config->control_thread ? "true" : "false");
+	INFO("  displays = %s\n", config->displays == NULL ? "<default>" : config->displays);
 	INFO("  poll = %d\n", config->poll);
+	INFO("  pollmax = %d\n", config->poll_max);
+	INFO("  pollbattery = %d\n", config->poll_battery);
 	INFO("  delay = %d\n", config->delay);
+	INFO("  adaptive = %d between %d and %d ms\n", config->adaptive, config->delay_min,
+		config->delay_max);
+	INFO("  holddisabled = %d\n", config->hold_disabled);
+	INFO("  holdenabled = %d\n", config->hold_enabled);
+	INFO("  armkeys = %d within %d ms\n", config->arm_keys, config->arm_window);
+	INFO("  lowjitter = %s, rtpolicy = %s, rtpriority = %d, cpu = %d\n",
+		config->low_jitter ? "true" : "false", config->rt_policy, config->rt_priority, config->cpu);
+	INFO("  tickbudget = %d, togglebudget = %d, strictbudget = %s\n", config->tick_budget,
+		config->toggle_budget, config->strict_budget ? "true" : "false");
 	INFO("  pidfile = %s\n", config->pid_file == NULL ? "<none>" : config->pid_file);
+	INFO("  socket = %s\n", config->socket == NULL ? "<none>" : config->socket);
+	INFO("  tracefile = %s\n", config->trace_file == NULL ? "<none>" : config->trace_file);
 
-	display = XOpenDisplay(NULL);
-	if (display == NULL) {
-		ERROR("failed to open display\n");
+	loop = malloc(sizeof(Loop));
+	if (!loop_init(loop)) {
+		ERROR("failed to initialize event loop\n");
+		cleanup();
 		return 1;
 	}
-	DEBUG("X display opened\n");
 
-	control = malloc(sizeof(Control));
-	if (!control_init(control, display, config->property, config->enable, config->disable)) {
-		ERROR("failed to initialize control object\n");
+	signal_installer();
+	DEBUG("signal handling enabled\n");
+
+	/* the control threads talk to the server while the listeners do */
+	if (config->control_thread && strcmp(config->mechanism, "property") == 0 && !XInitThreads()) {
+		ERROR("failed to initialize Xlib for threads\n");
+		cleanup();
 		return 1;
 	}
-	DEBUG("control initialized\n");
+	XSetErrorHandler(xlib_error_handler);
+	XSetIOErrorHandler(xlib_io_error_handler);
 
-	listen = malloc(sizeof(Listen));
-	if (!listen_init(listen, display, config->modifiers, config->delay, config->poll)) {
-		ERROR("failed to initialize listen object\n");
+	if (!config_create_pid_file(config)) {
 		cleanup();
 		return 1;
 	}
-	DEBUG("listen initialized\n");
 
-	signal_installer();
-	DEBUG("signal handling enabled\n");
+	if (config->trace_file != NULL) {
+		if (!trace_open(&trace, config->trace_file, config->trace_size)) {
+			cleanup();
+			return 1;
+		}
+		DEBUG("tracing %d records to %s\n", config->trace_size, config->trace_file);
+	}
 
-	XSetErrorHandler(xlib_error_handler);
+	if (strcmp(config->mechanism, "uinput") == 0) {
+		proxy = malloc(sizeof(Proxy));
+		if (!proxy_init(proxy)) {
+			ERROR("failed to proxy any touchpad through %s\n", MTRACKD_UINPUT_DEV);
+			free(proxy);
+			proxy = NULL;
+			cleanup();
+			return 1;
+		}
+		if (!loop_add(loop, proxy_fd(proxy), proxy_handler, proxy)) {
+			cleanup();
+			return 1;
+		}
+		INFO("proxying %d touchpads through %s\n", proxy->device_count, MTRACKD_UINPUT_DEV);
+	}
 
-	if (!config_create_pid_file(config)) {
+	names = NULL;
+	count = seat_split(config->displays, &names);
+	seats = calloc(count > 0 ? count : 1, sizeof(Seat));
+	seat_count = count > 0 ? count : 1;
+	for (i = 0; i < seat_count; i++) {
+		if (seat_open(&seats[i], count > 0 ? names[i] : NULL, config, proxy, loop,
+				control_lost))
+			INFO("serving display %s\n", seats[i].name);
+	}
+	for (i = 0; i < count; i++)
+		free(names[i]);
+	free(names);
+
+	if (active_seats() == 0) {
+		ERROR("failed to open any display\n");
+		cleanup();
+		return 1;
+	}
+
+	if (config->socket != NULL) {
+		server = malloc(sizeof(Server));
+		if (!server_init(server, config->socket, loop, seats, seat_count)) {
+			ERROR("failed to start control socket\n");
+			free(server);
+			server = NULL;
+			cleanup();
+			return 1;
+		}
+		DEBUG("control socket listening on %s\n", config->socket);
+	}
+
+	config_fd = config_watch(config);
+	if (config_fd == -1 || !loop_add(loop, config_fd, config_read, NULL))
+		WARN("not watching %s for changes\n", config->file);
+
+	signal_redirect();
+	DEBUG("signals redirected to the event loop\n");
+
+	/* everything is allocated by now, so locking memory faults it all in once,
+	 * and the threads already started are changed along with this one */
+	if (config->low_jitter && !realtime_enter(config->rt_policy, config->rt_priority, config->cpu)) {
 		cleanup();
 		return 1;
 	}
 
-	DEBUG("finding trackpad devices\n");
-	control_find_devices(control);
+	/* a lost display jumps back here to be dropped from the loop */
+	if (setjmp(io_error_jump) != 0) {
+		WARN("lost connection to display %s\n", io_error_seat->name);
+		seat_lost(io_error_seat, loop);
+		if (active_seats() == 0) {
+			ERROR("no displays left to serve\n");
+			cleanup();
+			return 2;
+		}
+	}
+	io_error_ready = True;
 
 	INFO("listener running\n");
-	listen_run(listen, control);
+	loop_run(loop);
 
-	ERROR("listener failed to start, this should not happen\n");
-	return 1;
+	DEBUG("shutting down\n");
+	strict = config->strict_budget;
+	cleanup();
+	if (strict && (stats.tick.over > 0 || stats.toggle.over > 0)) {
+		fprintf(stderr, "[E] %lu ticks and %lu toggles went over their request budgets\n",
+			stats.tick.over, stats.toggle.over);
+		return 3;
+	}
+	return 0;
 }
 
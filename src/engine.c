@@ -0,0 +1,282 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "engine.h"
+#include <string.h>
+
+/* The upper bound of the first pause bucket and the ratio between bounds.
+ */
+#define ENGINE_PAUSE_FIRST 0.01
+#define ENGINE_PAUSE_STEP 1.2599210498948732
+
+/* Each interval learned counts 1/decay times as much as the one before, which
+ * is the same as decaying all earlier ones, so roughly the last 200 matter.
+ * The weights are scaled back down before they overflow. The fixed delay is
+ * used until the minimum number of intervals is known.
+ */
+#define ENGINE_PAUSE_DECAY 0.995
+#define ENGINE_PAUSE_RESCALE 1e100
+#define ENGINE_PAUSE_MIN_COUNT 20
+
+/* Upper bounds of the pause buckets in seconds, filled in by engine_init.
+ */
+static double engine_bounds[MTRACKD_ENGINE_PAUSE_BUCKETS];
+
+void engine_init(Engine* obj, int idle_time) {
+	int i;
+	double bound = ENGINE_PAUSE_FIRST;
+
+	for (i = 0; i < MTRACKD_ENGINE_PAUSE_BUCKETS; i++) {
+		engine_bounds[i] = bound;
+		bound *= ENGINE_PAUSE_STEP;
+	}
+
+	obj->modifiers = 0;
+	memset(obj->mask, 0xff, MTRACKD_KEYMAP_SIZE);
+	memset(obj->current, 0, MTRACKD_KEYMAP_SIZE);
+	memset(obj->previous, 0, MTRACKD_KEYMAP_SIZE);
+	obj->idle_time = ((double)idle_time)/1000.0;
+	obj->delay = obj->idle_time;
+	obj->adaptive = 0;
+	obj->delay_min = 0;
+	obj->delay_max = 0;
+	obj->last_key = 0;
+	memset(obj->pauses, 0, sizeof(obj->pauses));
+	obj->pause_weight = 0;
+	obj->pause_scale = 1.0;
+	obj->pause_count = 0;
+	obj->hold_disabled = 0;
+	obj->hold_enabled = 0;
+	obj->arm_keys = 1;
+	obj->arm_window = 0;
+	obj->paused = 0;
+	obj->enabled = 1;
+	obj->wanted = 1;
+	obj->last_activity = 0;
+	obj->changed = 0;
+	obj->key_index = 0;
+	obj->wanted_changes = 0;
+	obj->changes = 0;
+}
+
+void engine_set_modifiers(Engine* obj, int modifiers) {
+	obj->modifiers = modifiers;
+}
+
+void engine_set_modifier_key(Engine* obj, int keycode) {
+	if (keycode >= 0 && keycode < MTRACKD_KEYMAP_SIZE * 8)
+		obj->mask[keycode / 8] &= ~(1 << (keycode % 8));
+}
+
+void engine_sync(Engine* obj, const unsigned char* keymap) {
+	memcpy(obj->current, keymap, MTRACKD_KEYMAP_SIZE);
+	memcpy(obj->previous, keymap, MTRACKD_KEYMAP_SIZE);
+}
+
+/* Set the delay from the learned intervals, or to the fixed delay while too
+ * few are known.
+ */
+static void engine_adapt(Engine* obj) {
+	int i;
+	double sum = 0;
+	double bound;
+	double target = obj->pause_weight * obj->adaptive / 100.0;
+
+	if (obj->adaptive <= 0 || obj->pause_count < ENGINE_PAUSE_MIN_COUNT) {
+		obj->idle_time = obj->delay;
+		return;
+	}
+	for (i = 0; i < MTRACKD_ENGINE_PAUSE_BUCKETS - 1; i++) {
+		sum += obj->pauses[i];
+		if (sum >= target)
+			break;
+	}
+
+	bound = engine_bounds[i];
+	if (bound < obj->delay_min)
+		bound = obj->delay_min;
+	if (bound > obj->delay_max)
+		bound = obj->delay_max;
+	obj->idle_time = bound;
+}
+
+/* Add an interval between keystrokes to the decaying histogram.
+ */
+static void engine_learn(Engine* obj, double interval) {
+	int i = 0;
+
+	while (i < MTRACKD_ENGINE_PAUSE_BUCKETS - 1 && interval > engine_bounds[i])
+		i++;
+	obj->pauses[i] += obj->pause_scale;
+	obj->pause_weight += obj->pause_scale;
+	obj->pause_scale /= ENGINE_PAUSE_DECAY;
+	obj->pause_count++;
+
+	if (obj->pause_scale > ENGINE_PAUSE_RESCALE) {
+		for (i = 0; i < MTRACKD_ENGINE_PAUSE_BUCKETS; i++)
+			obj->pauses[i] /= obj->pause_scale;
+		obj->pause_weight /= obj->pause_scale;
+		obj->pause_scale = 1.0;
+	}
+	engine_adapt(obj);
+}
+
+void engine_set_delay(Engine* obj, int idle_time) {
+	obj->delay = ((double)idle_time)/1000.0;
+	engine_adapt(obj);
+}
+
+void engine_set_adaptive(Engine* obj, int percentile, int delay_min, int delay_max) {
+	obj->adaptive = percentile;
+	obj->delay_min = ((double)delay_min)/1000.0;
+	obj->delay_max = ((double)delay_max)/1000.0;
+	engine_adapt(obj);
+}
+
+void engine_set_hysteresis(Engine* obj, int hold_disabled, int hold_enabled,
+		int arm_keys, int arm_window) {
+	obj->hold_disabled = ((double)hold_disabled)/1000.0;
+	obj->hold_enabled = ((double)hold_enabled)/1000.0;
+	obj->arm_keys = arm_keys;
+	obj->arm_window = ((double)arm_window)/1000.0;
+}
+
+void engine_key(Engine* obj, double time) {
+	if (obj->adaptive > 0 && obj->last_key > 0 && time > obj->last_key)
+		engine_learn(obj, time - obj->last_key);
+	obj->last_key = time;
+	engine_hold(obj, time);
+	obj->key_times[obj->key_index++ % MTRACKD_ENGINE_MAX_KEYS] = time;
+}
+
+int engine_key_event(Engine* obj, int press, int keycode, double time) {
+	int byte_num = keycode / 8;
+	unsigned char bit = 1 << (keycode % 8);
+	int typing;
+
+	if (keycode < 0 || keycode >= MTRACKD_KEYMAP_SIZE * 8)
+		return 0;
+
+	if (!press) {
+		obj->current[byte_num] &= ~bit;
+		typing = obj->modifiers && !(obj->mask[byte_num] & bit);
+	}
+	else if (obj->current[byte_num] & bit)
+		/* autorepeat */
+		typing = 0;
+	else {
+		obj->current[byte_num] |= bit;
+		typing = (obj->mask[byte_num] & bit) || obj->modifiers;
+	}
+
+	if (typing)
+		engine_key(obj, time);
+	return typing;
+}
+
+int engine_keymap(Engine* obj, const unsigned char* keymap, double time) {
+	int i;
+	int typing = 0;
+
+	memcpy(obj->current, keymap, MTRACKD_KEYMAP_SIZE);
+	for (i = 0; i < MTRACKD_KEYMAP_SIZE; i++) {
+		if (((obj->current[i] & ~obj->previous[i]) & obj->mask[i]) ||
+				(obj->modifiers && (obj->current[i] & ~obj->mask[i]))) {
+			typing = 1;
+			break;
+		}
+	}
+	memcpy(obj->previous, obj->current, MTRACKD_KEYMAP_SIZE);
+
+	if (typing)
+		engine_key(obj, time);
+	return typing;
+}
+
+int engine_modifier_held(Engine* obj) {
+	int i;
+	if (!obj->modifiers)
+		return 0;
+	for (i = 0; i < MTRACKD_KEYMAP_SIZE; i++) {
+		if (obj->current[i] & ~obj->mask[i])
+			return 1;
+	}
+	return 0;
+}
+
+void engine_hold(Engine* obj, double time) {
+	if (time > obj->last_activity)
+		obj->last_activity = time;
+}
+
+void engine_pause(Engine* obj, int paused) {
+	obj->paused = paused;
+}
+
+/* Check whether enough keystrokes happened recently to disable the
+ * trackpad.
+ */
+static int engine_armed(Engine* obj, double time) {
+	if (obj->arm_keys <= 1)
+		return 1;
+	if (obj->key_index < (unsigned int)obj->arm_keys)
+		return 0;
+	return obj->key_times[(obj->key_index - obj->arm_keys) % MTRACKD_ENGINE_MAX_KEYS] >=
+		time - obj->arm_window;
+}
+
+int engine_decide(Engine* obj, double time, double* deadline) {
+	int enabled = obj->enabled;
+	double expiry = obj->last_activity + obj->idle_time;
+	double held;
+
+	/* the state the delay alone asks for, which the hysteresis may hold back */
+	int wanted = obj->paused || time > expiry;
+	if (wanted != obj->wanted)
+		obj->wanted_changes++;
+	obj->wanted = wanted;
+
+	*deadline = 0;
+	if (obj->paused)
+		enabled = 1;
+	else if (wanted && !obj->enabled) {
+		if (time >= obj->changed + obj->hold_disabled)
+			enabled = 1;
+	}
+	else if (!wanted && obj->enabled && engine_armed(obj, time)) {
+		if (time >= obj->changed + obj->hold_enabled)
+			enabled = 0;
+		else
+			*deadline = obj->changed + obj->hold_enabled;
+	}
+
+	if (enabled != obj->enabled) {
+		obj->changed = time;
+		obj->changes++;
+	}
+	obj->enabled = enabled;
+
+	if (!enabled) {
+		held = obj->changed + obj->hold_disabled;
+		*deadline = held > expiry ? held : expiry;
+	}
+	return enabled;
+}
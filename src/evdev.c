@@ -0,0 +1,242 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "evdev.h"
+#include "common.h"
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#define EVDEV_PREFIX "event"
+#define EVDEV_READ_BATCH 64
+#define EVDEV_KEYCODE_OFFSET 8
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define NLONGS(x) (((x) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+static Bool evdev_is_keyboard(int fd) {
+	unsigned long evbits[NLONGS(EV_CNT)];
+	unsigned long keybits[NLONGS(KEY_CNT)];
+
+	memset(evbits, 0, sizeof(evbits));
+	memset(keybits, 0, sizeof(keybits));
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(evbits)), evbits) < 0 || !TEST_BIT(EV_KEY, evbits))
+		return False;
+	if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits) < 0)
+		return False;
+	return TEST_BIT(KEY_A, keybits) && TEST_BIT(KEY_Z, keybits) &&
+		TEST_BIT(KEY_SPACE, keybits);
+}
+
+static Bool evdev_is_open(Evdev* obj, int fd) {
+	int i;
+	struct stat a, b;
+	if (fstat(fd, &a) != 0)
+		return False;
+	for (i = 0; i < obj->fd_count; i++) {
+		if (fstat(obj->fds[i], &b) == 0 && a.st_rdev == b.st_rdev)
+			return True;
+	}
+	return False;
+}
+
+static void evdev_open(Evdev* obj, const char* name) {
+	int fd;
+	int clock = CLOCK_MONOTONIC;
+	char path[PATH_MAX];
+	struct epoll_event ev;
+
+	if (strncmp(name, EVDEV_PREFIX, strlen(EVDEV_PREFIX)) != 0)
+		return;
+
+	snprintf(path, sizeof(path), "%s/%s", MTRACKD_EVDEV_DIR, name);
+	fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		DEBUG("could not open %s: %s\n", path, strerror(errno));
+		return;
+	}
+	if (!evdev_is_keyboard(fd) || evdev_is_open(obj, fd)) {
+		close(fd);
+		return;
+	}
+	if (obj->fd_count == MTRACKD_EVDEV_MAX_KEYBOARDS) {
+		WARN("too many keyboards, ignoring %s\n", path);
+		close(fd);
+		return;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(obj->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		WARN("could not watch %s: %s\n", path, strerror(errno));
+		close(fd);
+		return;
+	}
+	/* kernels older than 3.4 only stamp events with the wall clock, those are
+	 * stamped when read instead */
+	obj->monotonic[obj->fd_count] = ioctl(fd, EVIOCSCLOCKID, &clock) == 0;
+	obj->fds[obj->fd_count++] = fd;
+	DEBUG("opened keyboard %s\n", path);
+}
+
+static void evdev_close(Evdev* obj, int fd) {
+	int i;
+	for (i = 0; i < obj->fd_count; i++) {
+		if (obj->fds[i] == fd) {
+			obj->fd_count--;
+			obj->fds[i] = obj->fds[obj->fd_count];
+			obj->monotonic[i] = obj->monotonic[obj->fd_count];
+			break;
+		}
+	}
+	epoll_ctl(obj->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+	DEBUG("keyboard closed, %d remaining\n", obj->fd_count);
+}
+
+static void evdev_watch(Evdev* obj) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event* ev;
+	ssize_t len;
+	char* ptr;
+
+	while ((len = read(obj->watch_fd, buf, sizeof(buf))) > 0) {
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ev->len) {
+			ev = (struct inotify_event*)ptr;
+			if (ev->len > 0)
+				evdev_open(obj, ev->name);
+		}
+	}
+}
+
+static void evdev_read_device(Evdev* obj, int fd, EvdevKeyHandler handler, void* data) {
+	struct input_event buf[EVDEV_READ_BATCH];
+	ssize_t len;
+	size_t i;
+	int index;
+	double time;
+
+	for (index = 0; index < obj->fd_count; index++) {
+		if (obj->fds[index] == fd)
+			break;
+	}
+	if (index == obj->fd_count)
+		return;
+
+	while ((len = read(fd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < len / sizeof(struct input_event); i++) {
+			/* value 2 is autorepeat, buttons are not typing */
+			if (buf[i].type != EV_KEY || buf[i].value == 2 || buf[i].code >= BTN_MISC)
+				continue;
+			if (obj->monotonic[index])
+				time = buf[i].input_event_sec + buf[i].input_event_usec / 1000000.0;
+			else
+				time = now();
+			handler(data, buf[i].value == 1, buf[i].code + EVDEV_KEYCODE_OFFSET, time);
+		}
+	}
+
+	if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR))
+		evdev_close(obj, fd);
+}
+
+Bool evdev_init(Evdev* obj) {
+	DIR* dir;
+	struct dirent* ent;
+	struct epoll_event ev;
+
+	obj->fd_count = 0;
+	obj->watch_fd = -1;
+	obj->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (obj->epoll_fd < 0) {
+		ERROR("could not create epoll instance: %s\n", strerror(errno));
+		return False;
+	}
+
+	obj->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (obj->watch_fd >= 0 &&
+			inotify_add_watch(obj->watch_fd, MTRACKD_EVDEV_DIR, IN_CREATE | IN_ATTRIB) >= 0) {
+		ev.events = EPOLLIN;
+		ev.data.fd = obj->watch_fd;
+		epoll_ctl(obj->epoll_fd, EPOLL_CTL_ADD, obj->watch_fd, &ev);
+	}
+	else
+		WARN("not watching %s for new keyboards\n", MTRACKD_EVDEV_DIR);
+
+	dir = opendir(MTRACKD_EVDEV_DIR);
+	if (dir == NULL) {
+		ERROR("could not read %s: %s\n", MTRACKD_EVDEV_DIR, strerror(errno));
+		evdev_free(obj);
+		return False;
+	}
+	while ((ent = readdir(dir)) != NULL)
+		evdev_open(obj, ent->d_name);
+	closedir(dir);
+
+	if (obj->fd_count == 0) {
+		evdev_free(obj);
+		return False;
+	}
+	return True;
+}
+
+int evdev_fd(Evdev* obj) {
+	return obj->epoll_fd;
+}
+
+void evdev_read(Evdev* obj, EvdevKeyHandler handler, void* data) {
+	int i, n;
+	struct epoll_event events[MTRACKD_EVDEV_MAX_KEYBOARDS + 1];
+
+	n = epoll_wait(obj->epoll_fd, events, MTRACKD_EVDEV_MAX_KEYBOARDS + 1, 0);
+	for (i = 0; i < n; i++) {
+		if (events[i].data.fd == obj->watch_fd)
+			evdev_watch(obj);
+		else
+			evdev_read_device(obj, events[i].data.fd, handler, data);
+	}
+}
+
+void evdev_free(Evdev* obj) {
+	while (obj->fd_count > 0)
+		evdev_close(obj, obj->fds[0]);
+	if (obj->watch_fd >= 0)
+		close(obj->watch_fd);
+	if (obj->epoll_fd >= 0)
+		close(obj->epoll_fd);
+	obj->watch_fd = -1;
+	obj->epoll_fd = -1;
+}
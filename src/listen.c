@@ -20,84 +20,425 @@
  **************************************************************************/
 
 #include "listen.h"
+#include "common.h"
+#include "stats.h"
+#include "trace.h"
+#include <dirent.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
-#include <sys/time.h>
 #include <unistd.h>
+#include <sys/timerfd.h>
+#include <X11/extensions/XInput2.h>
 
-static double now() {
-	struct timeval tv;
-	gettimeofday(&tv, NULL);
-	return tv.tv_sec + tv.tv_usec / 1000000.0;
+#define LISTEN_POWER_SUPPLY_DIR "/sys/class/power_supply"
+#define LISTEN_POWER_CHECK_INTERVAL 60
+
+/* Pass on input the engine counted as typing to the trace. Returns whether it
+ * was typing.
+ */
+static Bool listen_key(Listen* obj, Bool typing, double time) {
+	if (typing)
+		trace_record(&trace, MTRACKD_TRACE_KEY, time, 0);
+	return typing;
 }
 
-static void clear_bit(unsigned char *ptr, int bit)
-{
-    int byte_num = bit / 8;
-    int bit_num = bit % 8;
-    ptr[byte_num] &= ~(1 << bit_num);
+/* Handle a raw key event. The generic event data must already be retrieved.
+ * Returns True if the event counts as activity.
+ */
+static Bool listen_event(Listen* obj, XEvent* ev, double time) {
+	XGenericEventCookie* cookie = &ev->xcookie;
+	XIRawEvent* raw;
+
+	if (obj->backend != MTRACKD_BACKEND_XINPUT2 || cookie->type != GenericEvent ||
+			cookie->extension != obj->xi_opcode || cookie->data == NULL)
+		return False;
+
+	if (cookie->evtype == XI_RawKeyPress || cookie->evtype == XI_RawKeyRelease) {
+		raw = cookie->data;
+		return listen_key(obj, engine_key_event(&obj->engine,
+			cookie->evtype == XI_RawKeyPress, raw->detail, time), time);
+	}
+	return False;
 }
 
-static Bool listen_activity(Listen* obj) {
-	int i;
-	Bool res = False;
-	XQueryKeymap(obj->display, (char*)obj->current);
-
-	for (i = 0; i < MTRACKD_KEYMAP_SIZE; i++) {
-		if ((obj->current[i] & ~obj->previous[i]) & obj->mask[i]) {
-			res = True;
-			break;
-		} else if (obj->modifiers && (obj->current[i] & ~obj->mask[i])) {
-			res = True;
-			break;
-		}
+/* Remember when the keystroke which is about to disable the trackpad
+ * happened, so the detection latency can be recorded once it is disabled.
+ */
+static void listen_stamp(Listen* obj, double time) {
+	if (obj->engine.enabled && obj->key_time == 0)
+		obj->key_time = time;
+}
+
+/* Convert an X server timestamp to the monotonic clock. The X.org server
+ * stamps events with the monotonic clock in milliseconds, so the result is
+ * only off by rounding. Other servers get the time the event was read.
+ */
+static double listen_server_time(Time time) {
+	double current = now();
+	unsigned long delta = ((unsigned long)(current * 1000.0) - time) & 0xffffffffUL;
+	if (delta > 10000)
+		return current;
+	return current - delta / 1000.0;
+}
+
+static void listen_evdev_key(void* data, Bool press, int keycode, double time) {
+	Listen* obj = data;
+	if (listen_key(obj, engine_key_event(&obj->engine, press, keycode, time), time))
+		listen_stamp(obj, time);
+}
+
+static Bool listen_select_xi2(Listen* obj) {
+	int event, error;
+	int major = 2, minor = 0;
+	unsigned char bits[XIMaskLen(XI_LASTEVENT)];
+	XIEventMask mask;
+
+	if (!XQueryExtension(obj->display, "XInputExtension", &obj->xi_opcode, &event, &error)) {
+		DEBUG("xinput extension not available\n");
+		return False;
+	}
+	if (XIQueryVersion(obj->display, &major, &minor) != Success) {
+		DEBUG("xinput2 not supported by the server\n");
+		return False;
 	}
 
-	memcpy(obj->previous, obj->current,
-		sizeof(unsigned char)*MTRACKD_KEYMAP_SIZE);
+	memset(bits, 0, sizeof(bits));
+	XISetMask(bits, XI_RawKeyPress);
+	XISetMask(bits, XI_RawKeyRelease);
+	mask.deviceid = XIAllMasterDevices;
+	mask.mask_len = sizeof(bits);
+	mask.mask = bits;
+
+	XISelectEvents(obj->display, DefaultRootWindow(obj->display), &mask, 1);
+	XFlush(obj->display);
+	DEBUG("listening for xinput2 %d.%d raw key events\n", major, minor);
+	return True;
+}
+
+/* Arm the timer to fire at the given time on the monotonic clock, or disarm it
+ * if time is zero. In poll mode the timer instead fires every poll interval.
+ */
+static void listen_arm(Listen* obj, double time) {
+	struct itimerspec spec;
+
+	if (time == obj->deadline)
+		return;
+
+	memset(&spec, 0, sizeof(spec));
+	if (time > 0) {
+		spec.it_value.tv_sec = (time_t)time;
+		spec.it_value.tv_nsec = (long)((time - spec.it_value.tv_sec) * 1000000000.0);
+	}
+	timerfd_settime(obj->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+	obj->deadline = time;
+}
+
+static void listen_x_handler(void* data, uint32_t events) {
+	Listen* obj = data;
+	XEvent ev;
+
+	while (XPending(obj->display)) {
+		XNextEvent(obj->display, &ev);
+		if (ev.type == GenericEvent && !XGetEventData(obj->display, &ev.xcookie))
+			ev.xcookie.data = NULL;
+		if (listen_event(obj, &ev, now()))
+			listen_stamp(obj, listen_server_time(((XIRawEvent*)ev.xcookie.data)->time));
+		else if (obj->control->display == obj->display)
+			control_handle_event(obj->control, &ev);
+		if (ev.type == GenericEvent && ev.xcookie.data != NULL)
+			XFreeEventData(obj->display, &ev.xcookie);
+	}
+}
+
+static void listen_evdev_handler(void* data, uint32_t events) {
+	Listen* obj = data;
+	evdev_read(&obj->evdev, listen_evdev_key, obj);
+}
+
+/* Read the first word of a sysfs attribute. Returns False if it could not
+ * be read.
+ */
+static Bool listen_read_attr(const char* supply, const char* attr, char* buf, int size) {
+	FILE* f;
+	char path[PATH_MAX];
+	Bool res;
+
+	snprintf(path, sizeof(path), "%s/%s/%s", LISTEN_POWER_SUPPLY_DIR, supply, attr);
+	f = fopen(path, "r");
+	if (f == NULL)
+		return False;
+	res = fgets(buf, size, f) != NULL;
+	fclose(f);
+	if (res)
+		buf[strcspn(buf, "\n")] = '\0';
 	return res;
 }
 
-Bool listen_init(Listen* obj, Display* display, Bool modifiers,
-		int idle_time, int poll_time) {
+/* Check whether the machine runs on battery. Machines without a mains power
+ * supply in sysfs are assumed to be plugged in.
+ */
+static Bool listen_check_battery() {
+	DIR* dir;
+	struct dirent* ent;
+	char buf[32];
+	Bool mains = False;
+	Bool online = False;
+
+	dir = opendir(LISTEN_POWER_SUPPLY_DIR);
+	if (dir == NULL)
+		return False;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.' ||
+				!listen_read_attr(ent->d_name, "type", buf, sizeof(buf)) ||
+				strcmp(buf, "Mains") != 0)
+			continue;
+		mains = True;
+		if (listen_read_attr(ent->d_name, "online", buf, sizeof(buf)) && strcmp(buf, "1") == 0)
+			online = True;
+	}
+	closedir(dir);
+	return mains && !online;
+}
+
+/* Schedule the next keyboard poll. Polls at the configured interval while
+ * there is activity or the trackpad is disabled, and doubles the interval on
+ * every idle poll up to the idle ceiling.
+ */
+static void listen_schedule_poll(Listen* obj, Bool active) {
+	int ceiling = obj->poll_max;
+	double current_time = now();
+	struct itimerspec spec;
+
+	if (obj->poll_battery > 0) {
+		if (current_time >= obj->power_checked + LISTEN_POWER_CHECK_INTERVAL) {
+			obj->on_battery = listen_check_battery();
+			obj->power_checked = current_time;
+		}
+		if (obj->on_battery)
+			ceiling = obj->poll_battery;
+	}
+
+	if (active || current_time <= obj->engine.last_activity + obj->engine.idle_time)
+		obj->poll_interval = obj->poll_time;
+	else if (obj->poll_interval < ceiling)
+		obj->poll_interval *= 2;
+	if (obj->poll_interval > ceiling)
+		obj->poll_interval = ceiling > obj->poll_time ? ceiling : obj->poll_time;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = obj->poll_interval / 1000000;
+	spec.it_value.tv_nsec = (obj->poll_interval % 1000000) * 1000;
+	timerfd_settime(obj->timer_fd, 0, &spec, NULL);
+}
+
+static void listen_timer_handler(void* data, uint32_t events) {
+	Listen* obj = data;
+	Bool active;
+	double current_time;
+	uint64_t expirations;
+
+	if (read(obj->timer_fd, &expirations, sizeof(expirations)) < 0)
+		return;
+	if (obj->backend != MTRACKD_BACKEND_POLL)
+		return;
+
+	XQueryKeymap(obj->display, (char*)obj->keymap);
+	obj->round_trips++;
+	current_time = now();
+	active = listen_key(obj, engine_keymap(&obj->engine, obj->keymap, current_time), current_time);
+	/* the key went down at some point since the previous poll, so the middle
+	 * of that interval is the best guess at when */
+	if (active && obj->poll_last > 0)
+		listen_stamp(obj, (obj->poll_last + current_time) / 2.0);
+	obj->poll_last = current_time;
+	listen_schedule_poll(obj, active);
+}
+
+/* Account the requests made on the display since the last tick to this tick.
+ * Ticks which toggle the trackpad on this display are accounted by the toggle
+ * instead.
+ */
+static void listen_count_requests(Listen* obj, Bool toggled) {
+	unsigned long request = NextRequest(obj->display);
+	unsigned long requests = request - obj->request;
+	unsigned long round_trips = obj->round_trips;
+
+	obj->request = request;
+	obj->round_trips = 0;
+	if (toggled)
+		return;
+	if (!stats_requests(&stats.tick, requests, round_trips))
+		WARN("an idle tick of display %s took %lu requests, over the budget of %lu\n",
+			DisplayString(obj->display), requests, stats.tick.budget);
+}
+
+/* Decide on the trackpad state and arm the timer for the next time that
+ * decision can change. Runs before every wait.
+ */
+static void listen_prepare(void* data) {
+	Listen* obj = data;
+	Bool was_enabled = obj->engine.enabled;
+	unsigned long wanted_changes = obj->engine.wanted_changes;
+	Bool enabled;
+	double current_time;
+	double deadline;
+
+	/* other requests may have queued events without the socket being readable */
+	if (XQLength(obj->display) > 0)
+		listen_x_handler(obj, 0);
+
+	current_time = now();
+	if (engine_modifier_held(&obj->engine)) {
+		engine_hold(&obj->engine, current_time);
+		trace_record(&trace, MTRACKD_TRACE_HOLD, current_time, 0);
+	}
+
+	enabled = engine_decide(&obj->engine, current_time, &deadline);
+	stats.wanted += obj->engine.wanted_changes - wanted_changes;
+	if (enabled != was_enabled) {
+		stats.changed++;
+		trace_record(&trace, MTRACKD_TRACE_DECISION, current_time, enabled);
+	}
+	control_request(obj->control, enabled, current_time);
+	XFlush(obj->display);
+	listen_count_requests(obj, enabled != was_enabled && obj->control->display == obj->display);
+
+	if (!enabled && obj->key_time > 0)
+		stats_record(&stats.detect, now() - obj->key_time);
+	else if (enabled && !was_enabled)
+		stats_record(&stats.enable, now() - (obj->engine.last_activity + obj->engine.idle_time));
+	obj->key_time = 0;
+
+	if (obj->backend == MTRACKD_BACKEND_POLL)
+		return;
+	/* a held modifier keeps pushing the deadline out, so wait for the key */
+	if (!enabled && engine_modifier_held(&obj->engine))
+		listen_arm(obj, 0);
+	else
+		listen_arm(obj, deadline);
+}
+
+Bool listen_init(Listen* obj, Display* display, char* backend, Bool modifiers,
+		int idle_time, int poll_time, int poll_max, int poll_battery) {
 	int i;
 	KeyCode kc;
 	XModifierKeymap* modmap;
+
+	obj->backend = MTRACKD_BACKEND_POLL;
+	obj->timer_fd = -1;
+	if (strcmp(backend, "auto") != 0 && strcmp(backend, "xinput2") != 0 &&
+			strcmp(backend, "evdev") != 0 && strcmp(backend, "poll") != 0) {
+		ERROR("unknown backend: %s\n", backend);
+		return False;
+	}
 	
-	obj->modifiers = modifiers;
-	obj->idle_time = ((double)idle_time)/1000.0;
+	engine_init(&obj->engine, idle_time);
+	engine_set_modifiers(&obj->engine, modifiers);
+	obj->key_time = 0;
+	obj->poll_last = 0;
+	obj->deadline = 0;
+	obj->request = 0;
+	obj->round_trips = 0;
+	obj->control = NULL;
 	obj->poll_time = poll_time*1000;
+	obj->poll_max = poll_max*1000;
+	obj->poll_battery = poll_battery*1000;
+	obj->poll_interval = obj->poll_time;
+	obj->on_battery = False;
+	obj->power_checked = 0;
 	obj->display = display;
-	memset(obj->mask, 0xff, MTRACKD_KEYMAP_SIZE);
-
 	modmap = XGetModifierMapping(obj->display);
 
 	for (i = 0; i < 8 * modmap->max_keypermod; i++) {
 		kc = modmap->modifiermap[i];
 		if (kc != 0)
-			clear_bit(obj->mask, kc);
+			engine_set_modifier_key(&obj->engine, kc);
 	}
 
 	XFreeModifiermap(modmap);
 
-	XQueryKeymap(obj->display, (char*)obj->current);
-	memcpy(obj->previous, obj->current,
-		sizeof(unsigned char)*MTRACKD_KEYMAP_SIZE);
+	XQueryKeymap(obj->display, (char*)obj->keymap);
+	engine_sync(&obj->engine, obj->keymap);
+
+	obj->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (obj->timer_fd < 0) {
+		ERROR("could not create timer\n");
+		return False;
+	}
+
+	if (strcmp(backend, "evdev") == 0) {
+		if (evdev_init(&obj->evdev)) {
+			obj->backend = MTRACKD_BACKEND_EVDEV;
+			DEBUG("listening for evdev key events on %d keyboards\n", obj->evdev.fd_count);
+			return True;
+		}
+		WARN("no readable keyboards in %s, falling back to X\n", MTRACKD_EVDEV_DIR);
+	}
+
+	if (strcmp(backend, "poll") != 0 && listen_select_xi2(obj))
+		obj->backend = MTRACKD_BACKEND_XINPUT2;
+	else
+		INFO("polling the keyboard every %d ms\n", poll_time);
 	return True;
 }
 
-void listen_run(Listen* obj, Control* ctrl) {
-	double current_time, last_activity = 0;
-	while (True) {
-		current_time = now();
-		if (listen_activity(obj))
-			last_activity = current_time;
-		
-		if (current_time > last_activity + obj->idle_time)
-			control_toggle(ctrl, True);
-		else
-			control_toggle(ctrl, False);
+Bool listen_start(Listen* obj, Control* ctrl, Loop* loop) {
+	obj->control = ctrl;
+	obj->request = NextRequest(obj->display);
+	trace_record(&trace, MTRACKD_TRACE_CONFIG, now(), obj->engine.idle_time * 1000.0);
+	if (!loop_add(loop, ConnectionNumber(obj->display), listen_x_handler, obj) ||
+			!loop_add(loop, obj->timer_fd, listen_timer_handler, obj) ||
+			!loop_add_prepare(loop, listen_prepare, obj))
+		return False;
 
-		usleep(obj->poll_time);
-	}
+	if (obj->backend == MTRACKD_BACKEND_EVDEV &&
+			!loop_add(loop, evdev_fd(&obj->evdev), listen_evdev_handler, obj))
+		return False;
+
+	if (obj->backend == MTRACKD_BACKEND_POLL)
+		listen_schedule_poll(obj, True);
+	return True;
+}
+
+void listen_stop(Listen* obj, Loop* loop) {
+	loop_remove(loop, ConnectionNumber(obj->display));
+	loop_remove(loop, obj->timer_fd);
+	loop_remove_prepare(loop, listen_prepare, obj);
+	if (obj->backend == MTRACKD_BACKEND_EVDEV)
+		loop_remove(loop, evdev_fd(&obj->evdev));
 }
 
+void listen_configure(Listen* obj, Bool modifiers, int idle_time, int poll_time,
+		int poll_max, int poll_battery) {
+	engine_set_modifiers(&obj->engine, modifiers);
+	engine_set_delay(&obj->engine, idle_time);
+	trace_record(&trace, MTRACKD_TRACE_CONFIG, now(), idle_time);
+	obj->poll_time = poll_time*1000;
+	obj->poll_max = poll_max*1000;
+	obj->poll_battery = poll_battery*1000;
+	if (obj->backend == MTRACKD_BACKEND_POLL)
+		listen_schedule_poll(obj, True);
+}
+
+void listen_set_hysteresis(Listen* obj, int hold_disabled, int hold_enabled,
+		int arm_keys, int arm_window) {
+	engine_set_hysteresis(&obj->engine, hold_disabled, hold_enabled, arm_keys, arm_window);
+}
+
+void listen_set_adaptive(Listen* obj, int percentile, int delay_min, int delay_max) {
+	engine_set_adaptive(&obj->engine, percentile, delay_min, delay_max);
+}
+
+void listen_pause(Listen* obj, Bool paused) {
+	engine_pause(&obj->engine, paused);
+}
+
+void listen_free(Listen* obj) {
+	if (obj->backend == MTRACKD_BACKEND_EVDEV)
+		evdev_free(&obj->evdev);
+	if (obj->timer_fd >= 0)
+		close(obj->timer_fd);
+	obj->timer_fd = -1;
+}
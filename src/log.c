@@ -0,0 +1,266 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#define LOG_TARGET_STDERR 0
+#define LOG_TARGET_FILE 1
+#define LOG_TARGET_SYSLOG 2
+
+/* A slot is free for the writer at position pos when its sequence equals pos,
+ * and readable when it equals pos + 1.
+ */
+typedef struct {
+	unsigned long seq;
+	char text[MTRACKD_LOG_RECORD_SIZE];
+} LogRecord;
+
+static LogRecord log_ring[MTRACKD_LOG_RECORDS];
+static unsigned long log_head = 0;
+static unsigned long log_tail = 0;
+static unsigned long log_drops = 0;
+static int log_sleeping = 0;
+static int log_stopping = 0;
+static int log_running = 0;
+static int log_target = LOG_TARGET_STDERR;
+static int log_fd = -1;
+static int log_wake_fd = -1;
+static pthread_t log_thread;
+
+static void log_wake() {
+	uint64_t one = 1;
+	if (write(log_wake_fd, &one, sizeof(one)) != sizeof(one))
+		return;
+}
+
+/* Claim a slot, returning NULL if the ring is full. Safe to call from any
+ * number of threads at once.
+ */
+static LogRecord* log_reserve(unsigned long* pos) {
+	LogRecord* rec;
+	unsigned long seq;
+	long diff;
+
+	*pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	for (;;) {
+		rec = &log_ring[*pos % MTRACKD_LOG_RECORDS];
+		seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+		diff = (long)(seq - *pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&log_head, pos, *pos + 1, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				return rec;
+		}
+		else if (diff < 0)
+			return NULL;
+		else
+			*pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	}
+}
+
+void log_printf(const char* prefix, const char* format, ...) {
+	va_list args;
+	LogRecord* rec;
+	unsigned long pos;
+	size_t len;
+
+	va_start(args, format);
+	if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+		fputs(prefix, stderr);
+		vfprintf(stderr, format, args);
+		va_end(args);
+		return;
+	}
+
+	rec = log_reserve(&pos);
+	if (rec == NULL) {
+		__atomic_add_fetch(&log_drops, 1, __ATOMIC_RELAXED);
+		va_end(args);
+		return;
+	}
+	len = strlen(prefix);
+	if (len >= sizeof(rec->text))
+		len = sizeof(rec->text) - 1;
+	memcpy(rec->text, prefix, len);
+	vsnprintf(rec->text + len, sizeof(rec->text) - len, format, args);
+	va_end(args);
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+
+	/* only wake the writer when it went to sleep on an empty ring */
+	if (__atomic_exchange_n(&log_sleeping, 0, __ATOMIC_SEQ_CST))
+		log_wake();
+}
+
+static void log_output(const char* text) {
+	int priority;
+	size_t len = strlen(text);
+
+	if (log_target != LOG_TARGET_SYSLOG) {
+		/* there is nowhere to report a failed write, so it counts as a drop */
+		if (write(log_fd, text, len) != (ssize_t)len)
+			__atomic_add_fetch(&log_drops, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	switch (text[0] == '[' ? text[1] : 'I') {
+	case 'E':
+		priority = LOG_ERR;
+		break;
+	case 'W':
+		priority = LOG_WARNING;
+		break;
+	case 'D':
+		priority = LOG_DEBUG;
+		break;
+	default:
+		priority = LOG_INFO;
+	}
+	/* syslog has its own severity, so the prefix is left out */
+	syslog(priority, "%s", text[0] == '[' && len > 4 ? text + 4 : text);
+}
+
+/* Write out one queued message. Returns 0 if the ring is empty.
+ */
+static int log_drain_one() {
+	LogRecord* rec = &log_ring[log_tail % MTRACKD_LOG_RECORDS];
+	if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != log_tail + 1)
+		return 0;
+	log_output(rec->text);
+	__atomic_store_n(&rec->seq, log_tail + MTRACKD_LOG_RECORDS, __ATOMIC_RELEASE);
+	log_tail++;
+	return 1;
+}
+
+static int log_empty() {
+	LogRecord* rec = &log_ring[log_tail % MTRACKD_LOG_RECORDS];
+	return __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != log_tail + 1;
+}
+
+static void* log_writer(void* data __attribute__((unused))) {
+	uint64_t count;
+
+	for (;;) {
+		while (log_drain_one());
+		if (__atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE) && log_empty())
+			break;
+
+		/* announce the sleep before checking again, so a message queued in
+		 * between either is seen here or wakes the read below */
+		__atomic_store_n(&log_sleeping, 1, __ATOMIC_SEQ_CST);
+		if (!log_empty() || __atomic_load_n(&log_stopping, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&log_sleeping, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		if (read(log_wake_fd, &count, sizeof(count)) < 0 && errno != EINTR)
+			break;
+	}
+	return NULL;
+}
+
+int log_start(const char* target) {
+	unsigned long i;
+	sigset_t all, old;
+	pthread_attr_t attr;
+	int res;
+
+	if (log_running)
+		return 1;
+	for (i = 0; i < MTRACKD_LOG_RECORDS; i++)
+		log_ring[i].seq = i;
+	log_head = 0;
+	log_tail = 0;
+	log_sleeping = 0;
+	log_stopping = 0;
+
+	if (strcmp(target, "stderr") == 0) {
+		log_target = LOG_TARGET_STDERR;
+		log_fd = STDERR_FILENO;
+	}
+	else if (strcmp(target, "syslog") == 0) {
+		log_target = LOG_TARGET_SYSLOG;
+		openlog("dispad", LOG_PID, LOG_DAEMON);
+	}
+	else {
+		log_target = LOG_TARGET_FILE;
+		log_fd = open(target, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if (log_fd < 0) {
+			fprintf(stderr, "[E] could not open log file %s: %s\n", target, strerror(errno));
+			return 0;
+		}
+	}
+
+	log_wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (log_wake_fd < 0) {
+		fprintf(stderr, "[E] could not create log wakeup: %s\n", strerror(errno));
+		log_stop();
+		return 0;
+	}
+
+	/* signals are handled by the main thread, never by the writer */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, MTRACKD_LOG_STACK);
+	res = pthread_create(&log_thread, &attr, log_writer, NULL);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (res != 0) {
+		fprintf(stderr, "[E] could not start log writer: %s\n", strerror(res));
+		log_stop();
+		return 0;
+	}
+	__atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+void log_stop() {
+	if (__atomic_load_n(&log_running, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&log_stopping, 1, __ATOMIC_RELEASE);
+		log_wake();
+		if (!pthread_equal(pthread_self(), log_thread))
+			pthread_join(log_thread, NULL);
+		__atomic_store_n(&log_running, 0, __ATOMIC_RELEASE);
+	}
+	if (log_wake_fd >= 0)
+		close(log_wake_fd);
+	log_wake_fd = -1;
+	if (log_target == LOG_TARGET_FILE && log_fd >= 0)
+		close(log_fd);
+	else if (log_target == LOG_TARGET_SYSLOG)
+		closelog();
+	log_fd = -1;
+	log_target = LOG_TARGET_STDERR;
+}
+
+unsigned long log_dropped() {
+	return __atomic_load_n(&log_drops, __ATOMIC_RELAXED);
+}
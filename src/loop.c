@@ -0,0 +1,159 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "loop.h"
+#include "common.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+Bool loop_init(Loop* obj) {
+	int i;
+	obj->running = False;
+	obj->wakeups = 0;
+	obj->prepare_count = 0;
+	for (i = 0; i < MTRACKD_LOOP_MAX_WATCHES; i++) {
+		obj->watches[i].fd = -1;
+		obj->watches[i].handler = NULL;
+	}
+
+	obj->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (obj->epoll_fd < 0) {
+		ERROR("could not create epoll instance: %s\n", strerror(errno));
+		return False;
+	}
+	return True;
+}
+
+Bool loop_add(Loop* obj, int fd, LoopHandler handler, void* data) {
+	int i;
+	struct epoll_event ev;
+
+	for (i = 0; i < MTRACKD_LOOP_MAX_WATCHES; i++) {
+		if (obj->watches[i].fd == -1)
+			break;
+	}
+	if (i == MTRACKD_LOOP_MAX_WATCHES) {
+		ERROR("too many file descriptors in the event loop\n");
+		return False;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &obj->watches[i];
+	if (epoll_ctl(obj->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		ERROR("could not watch file descriptor %d: %s\n", fd, strerror(errno));
+		return False;
+	}
+
+	obj->watches[i].fd = fd;
+	obj->watches[i].handler = handler;
+	obj->watches[i].data = data;
+	return True;
+}
+
+void loop_set_events(Loop* obj, int fd, uint32_t events) {
+	int i;
+	struct epoll_event ev;
+
+	for (i = 0; i < MTRACKD_LOOP_MAX_WATCHES; i++) {
+		if (obj->watches[i].fd == fd) {
+			ev.events = events;
+			ev.data.ptr = &obj->watches[i];
+			epoll_ctl(obj->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+			return;
+		}
+	}
+}
+
+void loop_remove(Loop* obj, int fd) {
+	int i;
+	for (i = 0; i < MTRACKD_LOOP_MAX_WATCHES; i++) {
+		if (obj->watches[i].fd == fd) {
+			epoll_ctl(obj->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			obj->watches[i].fd = -1;
+			obj->watches[i].handler = NULL;
+			return;
+		}
+	}
+}
+
+Bool loop_add_prepare(Loop* obj, LoopPrepare prepare, void* data) {
+	if (obj->prepare_count == MTRACKD_LOOP_MAX_PREPARE) {
+		ERROR("too many prepare functions in the event loop\n");
+		return False;
+	}
+	obj->prepare[obj->prepare_count] = prepare;
+	obj->prepare_data[obj->prepare_count] = data;
+	obj->prepare_count++;
+	return True;
+}
+
+void loop_remove_prepare(Loop* obj, LoopPrepare prepare, void* data) {
+	int i;
+	for (i = 0; i < obj->prepare_count; i++) {
+		if (obj->prepare[i] == prepare && obj->prepare_data[i] == data) {
+			obj->prepare_count--;
+			memmove(&obj->prepare[i], &obj->prepare[i + 1],
+				(obj->prepare_count - i) * sizeof(LoopPrepare));
+			memmove(&obj->prepare_data[i], &obj->prepare_data[i + 1],
+				(obj->prepare_count - i) * sizeof(void*));
+			return;
+		}
+	}
+}
+
+void loop_run(Loop* obj) {
+	int i, n;
+	LoopWatch* watch;
+	struct epoll_event events[MTRACKD_LOOP_MAX_WATCHES];
+
+	obj->running = True;
+	while (obj->running) {
+		for (i = 0; i < obj->prepare_count; i++)
+			obj->prepare[i](obj->prepare_data[i]);
+
+		n = epoll_wait(obj->epoll_fd, events, MTRACKD_LOOP_MAX_WATCHES, -1);
+		if (n < 0 && errno != EINTR) {
+			ERROR("failed to wait for events: %s\n", strerror(errno));
+			break;
+		}
+		obj->wakeups++;
+
+		/* a handler may remove other watches, which clears their handler */
+		for (i = 0; i < n; i++) {
+			watch = events[i].data.ptr;
+			if (watch->handler != NULL)
+				watch->handler(watch->data, events[i].events);
+		}
+	}
+	obj->running = False;
+}
+
+void loop_stop(Loop* obj) {
+	obj->running = False;
+}
+
+void loop_free(Loop* obj) {
+	if (obj->epoll_fd >= 0)
+		close(obj->epoll_fd);
+	obj->epoll_fd = -1;
+}
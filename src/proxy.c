@@ -0,0 +1,443 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "proxy.h"
+#include "common.h"
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/uinput.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#define PROXY_PREFIX "event"
+#define PROXY_SUFFIX " (dispad)"
+#define PROXY_READ_BATCH 64
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+#define SET_BIT(bit, array) (array[(bit) / BITS_PER_LONG] |= 1UL << ((bit) % BITS_PER_LONG))
+#define CLEAR_BIT(bit, array) (array[(bit) / BITS_PER_LONG] &= ~(1UL << ((bit) % BITS_PER_LONG)))
+
+/* Touchpads report absolute positions, a finger tool and touches, but unlike
+ * touchscreens are not direct input devices. Our own clones are skipped by
+ * name.
+ */
+static Bool proxy_is_touchpad(int fd, char* name, size_t size) {
+	size_t len;
+	unsigned long evbits[MTRACKD_LONGS(EV_CNT)];
+	unsigned long keybits[MTRACKD_LONGS(KEY_CNT)];
+	unsigned long absbits[MTRACKD_LONGS(ABS_CNT)];
+	unsigned long props[MTRACKD_LONGS(INPUT_PROP_CNT)];
+
+	memset(name, 0, size);
+	if (ioctl(fd, EVIOCGNAME(size - 1), name) < 0)
+		return False;
+	len = strlen(name);
+	if (len >= strlen(PROXY_SUFFIX) && strcmp(name + len - strlen(PROXY_SUFFIX), PROXY_SUFFIX) == 0)
+		return False;
+
+	memset(evbits, 0, sizeof(evbits));
+	memset(keybits, 0, sizeof(keybits));
+	memset(absbits, 0, sizeof(absbits));
+	memset(props, 0, sizeof(props));
+	if (ioctl(fd, EVIOCGBIT(0, sizeof(evbits)), evbits) < 0 ||
+			!TEST_BIT(EV_KEY, evbits) || !TEST_BIT(EV_ABS, evbits))
+		return False;
+	if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits) < 0 ||
+			ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits) < 0)
+		return False;
+	if (ioctl(fd, EVIOCGPROP(sizeof(props)), props) >= 0 && TEST_BIT(INPUT_PROP_DIRECT, props))
+		return False;
+	return TEST_BIT(BTN_TOUCH, keybits) && TEST_BIT(BTN_TOOL_FINGER, keybits) &&
+		TEST_BIT(ABS_X, absbits);
+}
+
+/* Copy the capabilities of one event type from the source to a uinput
+ * device.
+ */
+static Bool proxy_copy_bits(int source, int sink, int type, int count, unsigned long request) {
+	int code;
+	unsigned long bits[MTRACKD_LONGS(KEY_CNT)];
+	struct uinput_abs_setup abs;
+
+	memset(bits, 0, sizeof(bits));
+	if (ioctl(source, EVIOCGBIT(type, sizeof(bits)), bits) < 0)
+		return False;
+	for (code = 0; code < count; code++) {
+		if (!TEST_BIT(code, bits))
+			continue;
+		if (ioctl(sink, UI_SET_EVBIT, type) < 0 || ioctl(sink, request, code) < 0)
+			return False;
+		if (type == EV_ABS) {
+			memset(&abs, 0, sizeof(abs));
+			abs.code = code;
+			if (ioctl(source, EVIOCGABS(code), &abs.absinfo) < 0 ||
+					ioctl(sink, UI_ABS_SETUP, &abs) < 0)
+				return False;
+		}
+	}
+	return True;
+}
+
+/* Create a uinput device with the same capabilities and axis ranges as the
+ * source, so drivers treat it exactly like the real touchpad. Returns -1 on
+ * error.
+ */
+static int proxy_clone(int source, const char* name) {
+	int fd, prop;
+	unsigned long props[MTRACKD_LONGS(INPUT_PROP_CNT)];
+	struct uinput_setup setup;
+
+	fd = open(MTRACKD_UINPUT_DEV, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		WARN("could not open %s: %s\n", MTRACKD_UINPUT_DEV, strerror(errno));
+		return -1;
+	}
+
+	memset(props, 0, sizeof(props));
+	ioctl(source, EVIOCGPROP(sizeof(props)), props);
+	for (prop = 0; prop < INPUT_PROP_CNT; prop++) {
+		if (TEST_BIT(prop, props))
+			ioctl(fd, UI_SET_PROPBIT, prop);
+	}
+
+	memset(&setup, 0, sizeof(setup));
+	ioctl(source, EVIOCGID, &setup.id);
+	snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "%.*s%s",
+		(int)(UINPUT_MAX_NAME_SIZE - strlen(PROXY_SUFFIX) - 1), name, PROXY_SUFFIX);
+
+	if (!proxy_copy_bits(source, fd, EV_KEY, KEY_CNT, UI_SET_KEYBIT) ||
+			!proxy_copy_bits(source, fd, EV_REL, REL_CNT, UI_SET_RELBIT) ||
+			!proxy_copy_bits(source, fd, EV_ABS, ABS_CNT, UI_SET_ABSBIT) ||
+			!proxy_copy_bits(source, fd, EV_MSC, MSC_CNT, UI_SET_MSCBIT) ||
+			ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0) {
+		WARN("could not create a uinput clone of %s: %s\n", name, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static ProxyDevice* proxy_lookup(Proxy* obj, int fd) {
+	int i;
+	for (i = 0; i < obj->device_count; i++) {
+		if (obj->devices[i].source_fd == fd)
+			return &obj->devices[i];
+	}
+	return NULL;
+}
+
+static Bool proxy_is_open(Proxy* obj, int fd) {
+	int i;
+	struct stat a, b;
+	if (fstat(fd, &a) != 0)
+		return False;
+	for (i = 0; i < obj->device_count; i++) {
+		if (fstat(obj->devices[i].source_fd, &b) == 0 && a.st_rdev == b.st_rdev)
+			return True;
+	}
+	return False;
+}
+
+static void proxy_open(Proxy* obj, const char* file) {
+	int fd, sink;
+	int i;
+	char path[PATH_MAX];
+	char name[UINPUT_MAX_NAME_SIZE];
+	struct input_absinfo slots;
+	struct epoll_event ev;
+	ProxyDevice* dev;
+
+	if (strncmp(file, PROXY_PREFIX, strlen(PROXY_PREFIX)) != 0)
+		return;
+
+	snprintf(path, sizeof(path), "%s/%s", MTRACKD_EVDEV_DIR, file);
+	fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		DEBUG("could not open %s: %s\n", path, strerror(errno));
+		return;
+	}
+	if (!proxy_is_touchpad(fd, name, sizeof(name)) || proxy_is_open(obj, fd)) {
+		close(fd);
+		return;
+	}
+	if (obj->device_count == MTRACKD_PROXY_MAX_TOUCHPADS) {
+		WARN("too many touchpads, ignoring %s\n", path);
+		close(fd);
+		return;
+	}
+
+	sink = proxy_clone(fd, name);
+	if (sink < 0) {
+		close(fd);
+		return;
+	}
+	if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+		WARN("could not grab %s: %s\n", path, strerror(errno));
+		ioctl(sink, UI_DEV_DESTROY);
+		close(sink);
+		close(fd);
+		return;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(obj->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+		WARN("could not watch %s: %s\n", path, strerror(errno));
+		ioctl(fd, EVIOCGRAB, 0);
+		ioctl(sink, UI_DEV_DESTROY);
+		close(sink);
+		close(fd);
+		return;
+	}
+
+	dev = &obj->devices[obj->device_count++];
+	dev->source_fd = fd;
+	dev->sink_fd = sink;
+	dev->slots = ioctl(fd, EVIOCGABS(ABS_MT_SLOT), &slots) == 0 ? slots.maximum + 1 : 0;
+	dev->slot = dev->slots > 0 ? slots.value : 0;
+	memset(dev->keys, 0, sizeof(dev->keys));
+	ioctl(fd, EVIOCGKEY(sizeof(dev->keys)), dev->keys);
+	dev->keys_down = 0;
+	for (i = 0; i < KEY_CNT; i++) {
+		if (TEST_BIT(i, dev->keys))
+			dev->keys_down++;
+	}
+	dev->forwarding = obj->enabled && dev->keys_down == 0;
+	DEBUG("proxying touchpad %s (%s) with %d slots\n", name, path, dev->slots);
+}
+
+static void proxy_close(Proxy* obj, ProxyDevice* dev) {
+	epoll_ctl(obj->epoll_fd, EPOLL_CTL_DEL, dev->source_fd, NULL);
+	ioctl(dev->source_fd, EVIOCGRAB, 0);
+	close(dev->source_fd);
+	ioctl(dev->sink_fd, UI_DEV_DESTROY);
+	close(dev->sink_fd);
+	*dev = obj->devices[--obj->device_count];
+	DEBUG("touchpad closed, %d remaining\n", obj->device_count);
+}
+
+static void proxy_emit(struct input_event* buf, int* count, int type, int code, int value) {
+	memset(&buf[*count], 0, sizeof(struct input_event));
+	buf[*count].type = type;
+	buf[*count].code = code;
+	buf[*count].value = value;
+	(*count)++;
+}
+
+/* Lift every finger and button on the clone so nothing is left held while
+ * events are dropped. The input core filters out events which would not
+ * change the state of the clone.
+ */
+static void proxy_release(ProxyDevice* dev) {
+	int i, count = 0;
+	struct input_event buf[PROXY_READ_BATCH];
+
+	for (i = 0; i < KEY_CNT; i++) {
+		if (TEST_BIT(i, dev->keys)) {
+			if (count + 2 >= PROXY_READ_BATCH)
+				break;
+			proxy_emit(buf, &count, EV_KEY, i, 0);
+		}
+	}
+	for (i = 0; i < dev->slots && count + 3 < PROXY_READ_BATCH; i++) {
+		proxy_emit(buf, &count, EV_ABS, ABS_MT_SLOT, i);
+		proxy_emit(buf, &count, EV_ABS, ABS_MT_TRACKING_ID, -1);
+	}
+	proxy_emit(buf, &count, EV_SYN, SYN_REPORT, 0);
+	if (write(dev->sink_fd, buf, count * sizeof(struct input_event)) < 0)
+		DEBUG("could not release the touchpad clone: %s\n", strerror(errno));
+}
+
+/* Start forwarding again. The source only reports a slot when it changes, so
+ * the clone, which was left on the last slot released, is first moved to the
+ * slot the source last reported.
+ */
+static void proxy_resume(ProxyDevice* dev) {
+	struct input_event ev;
+
+	dev->forwarding = True;
+	if (dev->slots == 0)
+		return;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = EV_ABS;
+	ev.code = ABS_MT_SLOT;
+	ev.value = dev->slot;
+	if (write(dev->sink_fd, &ev, sizeof(ev)) < 0)
+		DEBUG("could not restore the touchpad slot: %s\n", strerror(errno));
+}
+
+static void proxy_watch(Proxy* obj) {
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event* ev;
+	ssize_t len;
+	char* ptr;
+
+	while ((len = read(obj->watch_fd, buf, sizeof(buf))) > 0) {
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ev->len) {
+			ev = (struct inotify_event*)ptr;
+			if (ev->len > 0)
+				proxy_open(obj, ev->name);
+		}
+	}
+}
+
+static void proxy_read_device(Proxy* obj, ProxyDevice* dev) {
+	struct input_event buf[PROXY_READ_BATCH];
+	ssize_t len;
+	size_t i, n, start;
+
+	while ((len = read(dev->source_fd, buf, sizeof(buf))) > 0) {
+		n = len / sizeof(struct input_event);
+		start = dev->forwarding ? 0 : n;
+		for (i = 0; i < n; i++) {
+			if (buf[i].type == EV_KEY && buf[i].code < KEY_CNT && buf[i].value != 2) {
+				if (buf[i].value && !TEST_BIT(buf[i].code, dev->keys)) {
+					SET_BIT(buf[i].code, dev->keys);
+					dev->keys_down++;
+				}
+				else if (!buf[i].value && TEST_BIT(buf[i].code, dev->keys)) {
+					CLEAR_BIT(buf[i].code, dev->keys);
+					dev->keys_down--;
+				}
+			}
+			else if (buf[i].type == EV_ABS && buf[i].code == ABS_MT_SLOT)
+				dev->slot = buf[i].value;
+			/* resume forwarding on a frame boundary once nothing is held */
+			else if (!dev->forwarding && obj->enabled && buf[i].type == EV_SYN &&
+					buf[i].code == SYN_REPORT && dev->keys_down == 0) {
+				proxy_resume(dev);
+				start = i + 1;
+			}
+		}
+		obj->dropped += start;
+		if (start < n && write(dev->sink_fd, &buf[start],
+				(n - start) * sizeof(struct input_event)) < 0)
+			DEBUG("could not forward touchpad events: %s\n", strerror(errno));
+	}
+
+	if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR))
+		proxy_close(obj, dev);
+}
+
+Bool proxy_init(Proxy* obj) {
+	DIR* dir;
+	struct dirent* ent;
+	struct epoll_event ev;
+
+	obj->device_count = 0;
+	obj->enabled = True;
+	obj->toggles = 0;
+	obj->dropped = 0;
+	obj->watch_fd = -1;
+	obj->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (obj->epoll_fd < 0) {
+		ERROR("could not create epoll instance: %s\n", strerror(errno));
+		return False;
+	}
+
+	obj->watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (obj->watch_fd >= 0 &&
+			inotify_add_watch(obj->watch_fd, MTRACKD_EVDEV_DIR, IN_CREATE | IN_ATTRIB) >= 0) {
+		ev.events = EPOLLIN;
+		ev.data.fd = obj->watch_fd;
+		epoll_ctl(obj->epoll_fd, EPOLL_CTL_ADD, obj->watch_fd, &ev);
+	}
+	else
+		WARN("not watching %s for new touchpads\n", MTRACKD_EVDEV_DIR);
+
+	dir = opendir(MTRACKD_EVDEV_DIR);
+	if (dir == NULL) {
+		ERROR("could not read %s: %s\n", MTRACKD_EVDEV_DIR, strerror(errno));
+		proxy_free(obj);
+		return False;
+	}
+	while ((ent = readdir(dir)) != NULL)
+		proxy_open(obj, ent->d_name);
+	closedir(dir);
+
+	if (obj->device_count == 0) {
+		proxy_free(obj);
+		return False;
+	}
+	return True;
+}
+
+int proxy_fd(Proxy* obj) {
+	return obj->epoll_fd;
+}
+
+void proxy_read(Proxy* obj) {
+	int i, n;
+	ProxyDevice* dev;
+	struct epoll_event events[MTRACKD_PROXY_MAX_TOUCHPADS + 1];
+
+	n = epoll_wait(obj->epoll_fd, events, MTRACKD_PROXY_MAX_TOUCHPADS + 1, 0);
+	for (i = 0; i < n; i++) {
+		if (events[i].data.fd == obj->watch_fd)
+			proxy_watch(obj);
+		else if ((dev = proxy_lookup(obj, events[i].data.fd)) != NULL)
+			proxy_read_device(obj, dev);
+	}
+}
+
+Bool proxy_toggle(Proxy* obj, int enable) {
+	int i;
+	ProxyDevice* dev;
+
+	if ((enable != 0) == obj->enabled)
+		return False;
+	obj->enabled = enable != 0;
+	obj->toggles++;
+
+	for (i = 0; i < obj->device_count; i++) {
+		dev = &obj->devices[i];
+		if (!enable && dev->forwarding) {
+			dev->forwarding = False;
+			proxy_release(dev);
+		}
+		else if (enable && !dev->forwarding && dev->keys_down == 0)
+			proxy_resume(dev);
+	}
+	return True;
+}
+
+void proxy_dump(Proxy* obj, FILE* out) {
+	fprintf(out, "[S] proxy: %d touchpads, %s, %lu toggles, %lu events dropped\n",
+		obj->device_count, obj->enabled ? "enabled" : "disabled", obj->toggles, obj->dropped);
+}
+
+void proxy_free(Proxy* obj) {
+	while (obj->device_count > 0)
+		proxy_close(obj, &obj->devices[0]);
+	if (obj->watch_fd >= 0)
+		close(obj->watch_fd);
+	if (obj->epoll_fd >= 0)
+		close(obj->epoll_fd);
+	obj->watch_fd = -1;
+	obj->epoll_fd = -1;
+}
@@ -0,0 +1,79 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "queue.h"
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+int queue_init(Queue* obj) {
+	obj->head = 0;
+	obj->tail = 0;
+	obj->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	return obj->fd >= 0;
+}
+
+void queue_free(Queue* obj) {
+	if (obj->fd >= 0)
+		close(obj->fd);
+	obj->fd = -1;
+}
+
+void queue_wake(Queue* obj) {
+	uint64_t one = 1;
+	if (write(obj->fd, &one, sizeof(one)) != sizeof(one))
+		return;
+}
+
+int queue_push(Queue* obj, double time, int enable) {
+	unsigned long head = obj->head;
+	QueueCommand* command;
+
+	if (head - __atomic_load_n(&obj->tail, __ATOMIC_ACQUIRE) >= MTRACKD_QUEUE_SIZE)
+		return 0;
+	command = &obj->commands[head & (MTRACKD_QUEUE_SIZE - 1)];
+	command->time = time;
+	command->enable = enable;
+	__atomic_store_n(&obj->head, head + 1, __ATOMIC_RELEASE);
+
+	queue_wake(obj);
+	return 1;
+}
+
+int queue_pop(Queue* obj, QueueCommand* command) {
+	unsigned long tail = obj->tail;
+
+	if (tail == __atomic_load_n(&obj->head, __ATOMIC_ACQUIRE))
+		return 0;
+	*command = obj->commands[tail & (MTRACKD_QUEUE_SIZE - 1)];
+	__atomic_store_n(&obj->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+void queue_clear(Queue* obj) {
+	uint64_t count;
+	if (read(obj->fd, &count, sizeof(count)) != sizeof(count))
+		return;
+}
+
+int queue_fd(Queue* obj) {
+	return obj->fd;
+}
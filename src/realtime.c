@@ -0,0 +1,136 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#define _GNU_SOURCE
+#include "realtime.h"
+#include "common.h"
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+
+/* Touch a stack frame as deep as the process will ever need while memory is
+ * locked, so the pages are resident before the first keystroke.
+ */
+static void realtime_prefault_stack() {
+	volatile unsigned char stack[MTRACKD_REALTIME_STACK];
+	memset((unsigned char*)stack, 0, sizeof(stack));
+}
+
+/* List the ids of all threads of the process, which the scheduling calls
+ * take to change one thread each. Returns the number stored in a newly
+ * allocated array, or 0 if the list could not be read.
+ */
+static int realtime_threads(pid_t** tids) {
+	int count = 0;
+	DIR* dir;
+	struct dirent* ent;
+	pid_t* grown;
+
+	*tids = NULL;
+	dir = opendir("/proc/self/task");
+	if (dir == NULL)
+		return 0;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] < '0' || ent->d_name[0] > '9')
+			continue;
+		grown = realloc(*tids, (count + 1) * sizeof(pid_t));
+		if (grown == NULL)
+			break;
+		*tids = grown;
+		(*tids)[count++] = atoi(ent->d_name);
+	}
+	closedir(dir);
+	return count;
+}
+
+static void realtime_schedule(const char* policy, int priority, pid_t* tids, int count) {
+	int i;
+	struct sched_param param;
+	int pol = strcmp(policy, "rr") == 0 ? SCHED_RR : SCHED_FIFO;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+	for (i = 0; i < count && sched_setscheduler(tids[i], pol, &param) == 0; i++);
+	if (i == count) {
+		DEBUG("running %d threads under SCHED_%s at priority %d\n", count,
+			pol == SCHED_RR ? "RR" : "FIFO", priority);
+		return;
+	}
+
+	WARN("could not run under real-time scheduling: %s\n", strerror(errno));
+	for (i = 0; i < count && setpriority(PRIO_PROCESS, tids[i], MTRACKD_REALTIME_NICE) == 0; i++);
+	if (i == count) {
+		INFO("running at nice %d instead\n", MTRACKD_REALTIME_NICE);
+	}
+	else {
+		WARN("could not raise the nice value either: %s\n", strerror(errno));
+	}
+}
+
+static void realtime_pin(int cpu, pid_t* tids, int count) {
+	int i;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	for (i = 0; i < count && sched_setaffinity(tids[i], sizeof(set), &set) == 0; i++);
+	if (i == count) {
+		DEBUG("pinned %d threads to cpu %d\n", count, cpu);
+	}
+	else {
+		WARN("could not pin to cpu %d: %s\n", cpu, strerror(errno));
+	}
+}
+
+Bool realtime_enter(const char* policy, int priority, int cpu) {
+	pid_t self = 0;
+	pid_t* tids;
+	int count;
+
+	/* MCL_CURRENT faults in everything mapped so far, MCL_FUTURE everything
+	 * mapped later, such as buffers Xlib grows on demand. */
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		ERROR("could not lock memory: %s\n", strerror(errno));
+		return False;
+	}
+	realtime_prefault_stack();
+
+	/* the calls below change one thread each, and only threads started
+	 * later inherit the result, so every running thread is changed */
+	count = realtime_threads(&tids);
+	if (count == 0) {
+		WARN("could not list threads, only changing the calling one\n");
+		tids = &self;
+		count = 1;
+	}
+	if (priority > 0)
+		realtime_schedule(policy, priority, tids, count);
+	if (cpu >= 0)
+		realtime_pin(cpu, tids, count);
+	if (tids != &self)
+		free(tids);
+	return True;
+}
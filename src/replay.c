@@ -0,0 +1,532 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "common.h"
+#include "engine.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+/* Timers fire after their deadline, never exactly on it.
+ */
+#define REPLAY_TIMER_SLACK 0.000001
+
+/* Synthetic input starts at a large uptime, where a double has the least
+ * precision left for sub-millisecond deadlines.
+ */
+#define REPLAY_BENCH_START 1000000.0
+#define REPLAY_BENCH_SEED 1
+#define REPLAY_BENCH_KEYMAPS 64
+
+/* Typing which resumes this soon after the trackpad came back counts as an
+ * early enable, when a resting palm would not have been suppressed.
+ */
+#define REPLAY_RESUME_WINDOW 500
+
+/* The daemon's default bounds of an adaptive delay.
+ */
+#define REPLAY_DELAY_MIN 250
+#define REPLAY_DELAY_MAX 2000
+
+int log_level = LOG_INFO;
+Trace trace;
+
+typedef struct {
+	Engine engine;
+	double deadline;
+	double disabled_at;
+	double disabled_time;
+	unsigned long keys;
+	unsigned long keys_enabled;
+	unsigned long recorded_changes;
+	unsigned long recorded_writes;
+	unsigned int recorded_delay;
+	double resume_window;
+	double enabled_at;
+	unsigned long early_enables;
+	double* enables;
+	long enable_count;
+	long enable_capacity;
+} Replay;
+
+typedef struct {
+	double time;
+	int press;
+	int keycode;
+} ReplayEvent;
+
+/* Keycodes of the usual modifier keys under X.org.
+ */
+static const int replay_modifier_keys[] = { 37, 50, 62, 64, 66, 105, 108, 133, 134 };
+
+static unsigned int replay_seed;
+
+static void usage() {
+	fprintf(stderr, "Usage: dispad-replay [-hm] [-d delay] [-H time] [-E time] [-k keys]\n");
+	fprintf(stderr, "            [-w time] [-a percentile] [-n min] [-x max] [-r time] file\n");
+	fprintf(stderr, "       dispad-replay [-hm] [-d delay] [-H time] [-E time] [-k keys]\n");
+	fprintf(stderr, "            [-w time] [-a percentile] [-n min] [-x max] [-r time] -b count\n");
+}
+
+static void help() {
+	usage();
+	fprintf(stderr, "\nReplay a trace recorded by dispad with --tracefile through the decision\n");
+	fprintf(stderr, "engine and report what the given settings would have done.\n\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  -d, --delay=MS            The delay to replay with. Defaults to the delay\n");
+	fprintf(stderr, "                            recorded in the trace.\n");
+	fprintf(stderr, "  -H, --holddisabled=MS     The shortest time the trackpad stays disabled.\n");
+	fprintf(stderr, "  -E, --holdenabled=MS      The shortest time the trackpad stays enabled.\n");
+	fprintf(stderr, "  -k, --armkeys=COUNT       Keystrokes within the arm window it takes to\n");
+	fprintf(stderr, "                            disable the trackpad.\n");
+	fprintf(stderr, "  -w, --armwindow=MS        The arm window.\n");
+	fprintf(stderr, "  -a, --adaptive=PCT        Learn the delay from this percentile of the pauses\n");
+	fprintf(stderr, "                            between keystrokes and compare it with the fixed\n");
+	fprintf(stderr, "                            delay.\n");
+	fprintf(stderr, "  -n, --delaymin=MS         The shortest adaptive delay. Defaults to %d.\n",
+		REPLAY_DELAY_MIN);
+	fprintf(stderr, "  -x, --delaymax=MS         The longest adaptive delay. Defaults to %d.\n",
+		REPLAY_DELAY_MAX);
+	fprintf(stderr, "  -r, --resume=MS           Count typing this soon after the trackpad came\n");
+	fprintf(stderr, "                            back as an early enable. Defaults to %d.\n",
+		REPLAY_RESUME_WINDOW);
+	fprintf(stderr, "  -m, --modifiers           Count modifier keys as typing in a benchmark.\n");
+	fprintf(stderr, "  -b, --bench=COUNT         Instead of replaying a trace, simulate COUNT key\n");
+	fprintf(stderr, "                            events from a fixed seed and time each step.\n");
+	fprintf(stderr, "  -h, --help                Display this help.\n");
+}
+
+/* Remember how long after the last activity the trackpad came back.
+ */
+static void replay_enabled(Replay* obj, double time) {
+	double* enables;
+
+	obj->enabled_at = time;
+	if (obj->enable_count == obj->enable_capacity) {
+		obj->enable_capacity = obj->enable_capacity > 0 ? obj->enable_capacity * 2 : 1024;
+		enables = realloc(obj->enables, obj->enable_capacity * sizeof(double));
+		if (enables == NULL) {
+			obj->enable_capacity = obj->enable_count;
+			return;
+		}
+		obj->enables = enables;
+	}
+	obj->enables[obj->enable_count++] = time - obj->engine.last_activity;
+}
+
+static void replay_decide(Replay* obj, double time) {
+	int was_enabled = obj->engine.enabled;
+	int enabled = engine_decide(&obj->engine, time, &obj->deadline);
+
+	if (was_enabled && !enabled)
+		obj->disabled_at = time;
+	else if (!was_enabled && enabled) {
+		obj->disabled_time += time - obj->disabled_at;
+		replay_enabled(obj, time);
+	}
+}
+
+/* Count a keystroke before it reaches the engine.
+ */
+static void replay_key(Replay* obj, double time) {
+	obj->keys++;
+	if (obj->engine.enabled) {
+		obj->keys_enabled++;
+		if (obj->enabled_at > 0 && time - obj->enabled_at < obj->resume_window)
+			obj->early_enables++;
+	}
+	obj->enabled_at = 0;
+}
+
+/* Let every timer which would have fired before the given time fire.
+ */
+static void replay_advance(Replay* obj, double time) {
+	double fired;
+	while (obj->deadline > 0 && obj->deadline + REPLAY_TIMER_SLACK < time) {
+		fired = obj->deadline + REPLAY_TIMER_SLACK;
+		replay_decide(obj, fired);
+		if (obj->deadline + REPLAY_TIMER_SLACK <= fired)
+			break;
+	}
+}
+
+/* A fixed generator, so every run simulates the same input.
+ */
+static unsigned int replay_random() {
+	replay_seed = replay_seed * 1103515245 + 12345;
+	return (replay_seed >> 16) & 0x7fff;
+}
+
+static double replay_uniform(double low, double high) {
+	return low + (high - low) * replay_random() / 32767.0;
+}
+
+/* Generate typing in bursts, with short pauses, long idle periods of up to two
+ * hours, held modifiers and repeated presses of keys already down.
+ */
+static void replay_generate(ReplayEvent* events, long count) {
+	long i;
+	unsigned int r;
+	double time = REPLAY_BENCH_START;
+	int keycode = 0;
+
+	replay_seed = REPLAY_BENCH_SEED;
+	for (i = 0; i < count; i++) {
+		r = replay_random() % 1000;
+		if (r < 900)
+			time += replay_uniform(0.01, 0.25);
+		else if (r < 990)
+			time += replay_uniform(1.0, 5.0);
+		else
+			time += replay_uniform(600.0, 7200.0);
+
+		/* every other event releases the key pressed before it */
+		if (i % 2 == 0) {
+			if (replay_random() % 10 == 0)
+				keycode = replay_modifier_keys[replay_random() %
+					(sizeof(replay_modifier_keys) / sizeof(int))];
+			else
+				keycode = 8 + replay_random() % 248;
+		}
+		events[i].time = time;
+		events[i].press = i % 2 == 0 || replay_random() % 20 == 0;
+		events[i].keycode = keycode;
+	}
+}
+
+static int replay_compare(const void* a, const void* b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+static void replay_report(Replay* obj, double span) {
+	double median = 0;
+
+	if (obj->enable_count > 0) {
+		qsort(obj->enables, obj->enable_count, sizeof(double), replay_compare);
+		median = obj->enables[obj->enable_count / 2];
+	}
+	printf("keystrokes: %lu, %lu while enabled\n", obj->keys, obj->keys_enabled);
+	printf("replayed: %lu state changes, %lu wanted\n",
+		obj->engine.changes, obj->engine.wanted_changes);
+	printf("disabled: %.1f%% of the time\n", span > 0 ? 100.0 * obj->disabled_time / span : 0.0);
+	printf("enabled: median %.0f ms after the last keystroke, %lu early within %.0f ms\n",
+		median * 1000.0, obj->early_enables, obj->resume_window * 1000.0);
+	if (obj->engine.adaptive > 0)
+		printf("delay: %.0f ms learned at the end\n", obj->engine.idle_time * 1000.0);
+}
+
+/* Print the report of the fixed delay baseline and the one under test.
+ */
+static void replay_compare_report(Replay* obj, Replay* baseline, double span) {
+	if (baseline == NULL) {
+		replay_report(obj, span);
+		return;
+	}
+	printf("\nfixed delay:\n");
+	replay_report(baseline, span);
+	printf("\nadaptive delay, p%d:\n", obj->engine.adaptive);
+	replay_report(obj, span);
+}
+
+/* Print the cost of one step, measured over count repetitions.
+ */
+static void replay_cost(const char* name, double elapsed, long count) {
+	printf("%-12s %8.1f ns\n", name, count > 0 ? elapsed * 1000000000.0 / count : 0.0);
+}
+
+/* Run the synthetic events through the engine, taking the whole path a key
+ * event takes: timers, the event and the decision. Returns the time taken.
+ */
+static double replay_simulate(Replay* obj, ReplayEvent* events, long count) {
+	long i;
+	double elapsed = now();
+
+	for (i = 0; i < count; i++) {
+		replay_advance(obj, events[i].time);
+		if (events[i].press)
+			replay_key(obj, events[i].time);
+		engine_key_event(&obj->engine, events[i].press, events[i].keycode, events[i].time);
+		if (engine_modifier_held(&obj->engine))
+			engine_hold(&obj->engine, events[i].time);
+		replay_decide(obj, events[i].time);
+	}
+	elapsed = now() - elapsed;
+	replay_advance(obj, events[count - 1].time);
+	if (!obj->engine.enabled)
+		obj->disabled_time += events[count - 1].time - obj->disabled_at;
+	return elapsed;
+}
+
+/* Run count synthetic events through the engine, then time each step of the
+ * hot path on its own. The simulated results only depend on the settings, so
+ * they can be compared between builds. A baseline is simulated the same way
+ * and reported alongside.
+ */
+static int replay_bench(Replay* obj, Replay* baseline, long count) {
+	long i;
+	double elapsed, span, deadline;
+	unsigned char keymaps[REPLAY_BENCH_KEYMAPS][MTRACKD_KEYMAP_SIZE];
+	ReplayEvent* events = malloc(count * sizeof(ReplayEvent));
+	Engine engine;
+	TraceHeader* header;
+
+	if (events == NULL) {
+		ERROR("could not allocate %ld events\n", count);
+		return 1;
+	}
+	for (i = 0; i < (long)(sizeof(replay_modifier_keys) / sizeof(int)); i++) {
+		engine_set_modifier_key(&obj->engine, replay_modifier_keys[i]);
+		if (baseline != NULL)
+			engine_set_modifier_key(&baseline->engine, replay_modifier_keys[i]);
+	}
+	replay_generate(events, count);
+	engine = obj->engine;
+
+	if (baseline != NULL)
+		replay_simulate(baseline, events, count);
+	elapsed = replay_simulate(obj, events, count);
+	span = events[count - 1].time - REPLAY_BENCH_START;
+
+	printf("simulated: %ld events over %.0f s\n", count, span);
+	replay_compare_report(obj, baseline, span);
+	printf("\nper event:\n");
+	replay_cost("total", elapsed, count);
+
+	elapsed = now();
+	for (i = 0; i < count; i++)
+		engine_key_event(&engine, events[i].press, events[i].keycode, events[i].time);
+	replay_cost("key event", now() - elapsed, count);
+
+	elapsed = now();
+	for (i = 0; i < count; i++)
+		engine_decide(&engine, events[i].time, &deadline);
+	replay_cost("decide", now() - elapsed, count);
+
+	for (i = 0; i < REPLAY_BENCH_KEYMAPS; i++) {
+		memset(keymaps[i], 0, MTRACKD_KEYMAP_SIZE);
+		keymaps[i][events[i % count].keycode / 8] |= 1 << (events[i % count].keycode % 8);
+	}
+	elapsed = now();
+	for (i = 0; i < count; i++)
+		engine_keymap(&engine, keymaps[i % REPLAY_BENCH_KEYMAPS], events[i].time);
+	replay_cost("keymap poll", now() - elapsed, count);
+
+	/* the recorder writes to memory only, so a heap ring measures the same */
+	header = calloc(1, sizeof(TraceHeader) + REPLAY_BENCH_KEYMAPS * sizeof(TraceRecord));
+	header->capacity = REPLAY_BENCH_KEYMAPS;
+	trace.header = header;
+	trace.records = (TraceRecord*)(header + 1);
+	elapsed = now();
+	for (i = 0; i < count; i++)
+		trace_record(&trace, MTRACKD_TRACE_KEY, events[i].time, 0);
+	replay_cost("trace", now() - elapsed, count);
+	trace_init(&trace);
+
+	free(header);
+	free(events);
+	return 0;
+}
+
+/* Replay count records from the open trace up to the given end time. The
+ * recorded delay applies unless one was given. Returns the time taken.
+ */
+static double replay_trace(Replay* obj, uint64_t first, uint64_t count, int delay, double end) {
+	uint64_t i;
+	TraceRecord* rec;
+	double elapsed = now();
+
+	for (i = first; i < first + count; i++) {
+		rec = trace_get(&trace, i);
+		replay_advance(obj, rec->time);
+		switch (rec->type) {
+		case MTRACKD_TRACE_KEY:
+			replay_key(obj, rec->time);
+			engine_key(&obj->engine, rec->time);
+			replay_decide(obj, rec->time);
+			break;
+		case MTRACKD_TRACE_HOLD:
+			engine_hold(&obj->engine, rec->time);
+			replay_decide(obj, rec->time);
+			break;
+		case MTRACKD_TRACE_DECISION:
+			obj->recorded_changes++;
+			break;
+		case MTRACKD_TRACE_WRITE:
+			obj->recorded_writes += rec->value;
+			break;
+		case MTRACKD_TRACE_CONFIG:
+			if (delay == 0) {
+				engine_set_delay(&obj->engine, rec->value);
+				if (obj->recorded_delay == 0)
+					obj->recorded_delay = rec->value;
+			}
+			break;
+		}
+	}
+	replay_advance(obj, end);
+	if (!obj->engine.enabled)
+		obj->disabled_time += end - obj->disabled_at;
+	return now() - elapsed;
+}
+
+int main(int argc, char** argv) {
+	int c;
+	int delay = 0;
+	int hold_disabled = 0;
+	int hold_enabled = 0;
+	int arm_keys = 1;
+	int arm_window = 0;
+	int modifiers = 0;
+	int adaptive = 0;
+	int delay_min = REPLAY_DELAY_MIN;
+	int delay_max = REPLAY_DELAY_MAX;
+	int resume = REPLAY_RESUME_WINDOW;
+	long bench = 0;
+	int res;
+	uint64_t first, count;
+	double start, end, elapsed, span;
+	Replay replay;
+	Replay baseline;
+	char* opts = "d:H:E:k:w:a:n:x:r:mb:h";
+	struct option lopts[] = {
+		{"delay", 1, 0, 'd'},
+		{"holddisabled", 1, 0, 'H'},
+		{"holdenabled", 1, 0, 'E'},
+		{"armkeys", 1, 0, 'k'},
+		{"armwindow", 1, 0, 'w'},
+		{"adaptive", 1, 0, 'a'},
+		{"delaymin", 1, 0, 'n'},
+		{"delaymax", 1, 0, 'x'},
+		{"resume", 1, 0, 'r'},
+		{"modifiers", 0, 0, 'm'},
+		{"bench", 1, 0, 'b'},
+		{"help", 0, 0, 'h'},
+		{NULL, 0, 0, 0}
+	};
+
+	while ((c = getopt_long(argc, argv, opts, lopts, NULL)) != -1) {
+		switch (c) {
+		case 'd':
+			delay = atoi(optarg);
+			break;
+		case 'H':
+			hold_disabled = atoi(optarg);
+			break;
+		case 'E':
+			hold_enabled = atoi(optarg);
+			break;
+		case 'k':
+			arm_keys = atoi(optarg);
+			break;
+		case 'w':
+			arm_window = atoi(optarg);
+			break;
+		case 'a':
+			adaptive = atoi(optarg);
+			break;
+		case 'n':
+			delay_min = atoi(optarg);
+			break;
+		case 'x':
+			delay_max = atoi(optarg);
+			break;
+		case 'r':
+			resume = atoi(optarg);
+			break;
+		case 'm':
+			modifiers = 1;
+			break;
+		case 'b':
+			bench = atol(optarg);
+			if (bench <= 0) {
+				ERROR("invalid event count: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'h':
+			help();
+			return 0;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind != argc - (bench > 0 ? 0 : 1)) {
+		usage();
+		return 1;
+	}
+	if (delay < 0 || hold_disabled < 0 || hold_enabled < 0 || arm_window < 0 ||
+			arm_keys < 1 || arm_keys > MTRACKD_ENGINE_MAX_KEYS || adaptive < 0 ||
+			adaptive > 99 || delay_min <= 0 || delay_max < delay_min || resume < 0) {
+		ERROR("invalid replay settings\n");
+		return 1;
+	}
+
+	memset(&replay, 0, sizeof(replay));
+	engine_init(&replay.engine, delay > 0 ? delay : 1000);
+	engine_set_hysteresis(&replay.engine, hold_disabled, hold_enabled, arm_keys, arm_window);
+	engine_set_modifiers(&replay.engine, modifiers);
+	replay.resume_window = resume / 1000.0;
+	baseline = replay;
+	engine_set_adaptive(&replay.engine, adaptive, delay_min, delay_max);
+
+	trace_init(&trace);
+	if (bench > 0) {
+		res = replay_bench(&replay, adaptive > 0 ? &baseline : NULL, bench);
+		free(replay.enables);
+		free(baseline.enables);
+		return res;
+	}
+	if (!trace_open(&trace, argv[optind], 0))
+		return 1;
+	count = trace_count(&trace, &first);
+	if (count == 0) {
+		ERROR("trace is empty: %s\n", argv[optind]);
+		trace_close(&trace);
+		return 1;
+	}
+
+	start = trace_get(&trace, first)->time;
+	end = trace_get(&trace, first + count - 1)->time;
+
+	if (adaptive > 0)
+		replay_trace(&baseline, first, count, delay, end);
+	elapsed = replay_trace(&replay, first, count, delay, end);
+	span = end - start;
+	if (replay.recorded_delay > 0)
+		INFO("replaying with the recorded delay of %u ms\n", replay.recorded_delay);
+
+	printf("records: %llu over %.3f s\n", (unsigned long long)count, span);
+	printf("recorded: %lu state changes, %lu writes\n",
+		replay.recorded_changes, replay.recorded_writes);
+	replay_compare_report(&replay, adaptive > 0 ? &baseline : NULL, span);
+	printf("replay: %.0f records/s, %.0fx real time\n",
+		elapsed > 0 ? count / elapsed : 0.0, elapsed > 0 ? span / elapsed : 0.0);
+
+	free(replay.enables);
+	free(baseline.enables);
+	trace_close(&trace);
+	return 0;
+}
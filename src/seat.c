@@ -0,0 +1,246 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "seat.h"
+#include "common.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <X11/extensions/XI.h>
+
+int seat_split(char* list, char*** names) {
+	int count = 0;
+	char* save = NULL;
+	char* copy;
+	char* name;
+
+	*names = NULL;
+	if (list == NULL)
+		return 0;
+
+	copy = strdup(list);
+	for (name = strtok_r(copy, ", \t", &save); name != NULL; name = strtok_r(NULL, ", \t", &save)) {
+		*names = realloc(*names, (count + 1) * sizeof(char*));
+		(*names)[count++] = strdup(name);
+	}
+	free(copy);
+	return count;
+}
+
+static void seat_retry(void* data, uint32_t events) {
+	Seat* obj = data;
+	control_retry(&obj->control);
+}
+
+/* Close the descriptor reporting errors. Watching it must have stopped.
+ */
+static void seat_close_error(Seat* obj) {
+	if (obj->error_fd >= 0)
+		close(obj->error_fd);
+	obj->error_fd = -1;
+}
+
+/* Stop watching the seat's and the control object's file descriptors, and
+ * close the seat's.
+ */
+static void seat_unwatch(Seat* obj, Loop* loop) {
+	if (obj->error_fd >= 0)
+		loop_remove(loop, obj->error_fd);
+	seat_close_error(obj);
+	if (control_lost_fd(&obj->control) >= 0)
+		loop_remove(loop, control_lost_fd(&obj->control));
+	if (control_retry_fd(&obj->control) >= 0)
+		loop_remove(loop, control_retry_fd(&obj->control));
+}
+
+/* Close the control connection if it is not the listener's. A connection the
+ * thread lost is left open, as Xlib may still hold its lock for the thread.
+ */
+static void seat_close_control(Seat* obj) {
+	if (obj->control_display != obj->display && !control_display_lost(&obj->control))
+		XCloseDisplay(obj->control_display);
+	obj->control_display = NULL;
+}
+
+Bool seat_open(Seat* obj, char* name, Config* config, Proxy* proxy, Loop* loop,
+		LoopHandler lost) {
+	Bool threaded = config->control_thread && proxy == NULL;
+	int xi_event;
+
+	obj->active = False;
+	obj->error_fd = -1;
+	obj->name = strdup(XDisplayName(name));
+	obj->display = XOpenDisplay(name);
+	if (obj->display == NULL) {
+		ERROR("failed to open display %s\n", obj->name);
+		free(obj->name);
+		return False;
+	}
+	DEBUG("X display %s opened\n", obj->name);
+
+	/* the error handler must not make requests, so it uses these */
+	if (!XQueryExtension(obj->display, INAME, &obj->xi_major, &xi_event, &obj->xi_error)) {
+		ERROR("failed to query xinput extension on display %s\n", obj->name);
+		XCloseDisplay(obj->display);
+		obj->display = NULL;
+		free(obj->name);
+		return False;
+	}
+
+	/* errors reported before the loop watches it are still counted */
+	obj->error_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (obj->error_fd < 0) {
+		ERROR("failed to create error wakeup: %s\n", strerror(errno));
+		XCloseDisplay(obj->display);
+		obj->display = NULL;
+		free(obj->name);
+		return False;
+	}
+
+	obj->control_display = threaded ? XOpenDisplay(name) : obj->display;
+	if (obj->control_display == NULL) {
+		ERROR("failed to open control connection to display %s\n", obj->name);
+		seat_close_error(obj);
+		XCloseDisplay(obj->display);
+		obj->display = NULL;
+		free(obj->name);
+		return False;
+	}
+
+	/* control_init closes its display when it fails */
+	if (!control_init(&obj->control, obj->control_display, config->property, config->enable,
+			config->disable, config->profiles, proxy)) {
+		ERROR("failed to initialize control object for display %s\n", obj->name);
+		seat_close_error(obj);
+		if (obj->control_display != obj->display)
+			XCloseDisplay(obj->display);
+		obj->control_display = NULL;
+		obj->display = NULL;
+		free(obj->name);
+		return False;
+	}
+
+	if (!listen_init(&obj->listen, obj->display, config->backend, config->modifiers,
+			config->delay, config->poll, config->poll_max, config->poll_battery)) {
+		ERROR("failed to initialize listen object for display %s\n", obj->name);
+		listen_free(&obj->listen);
+		control_free(&obj->control);
+		seat_close_control(obj);
+		seat_close_error(obj);
+		XCloseDisplay(obj->display);
+		obj->display = NULL;
+		free(obj->name);
+		return False;
+	}
+
+	listen_set_hysteresis(&obj->listen, config->hold_disabled, config->hold_enabled,
+		config->arm_keys, config->arm_window);
+	listen_set_adaptive(&obj->listen, config->adaptive, config->delay_min, config->delay_max);
+	control_set_cache(&obj->control, config->cache_file);
+	DEBUG("finding trackpad devices on display %s\n", obj->name);
+	control_find_devices(&obj->control);
+
+	if (!loop_add(loop, obj->error_fd, lost, obj)) {
+		ERROR("failed to watch for errors on display %s\n", obj->name);
+		obj->active = True;
+		seat_close(obj, loop);
+		return False;
+	}
+
+	if (threaded && (!control_start_thread(&obj->control) ||
+			!loop_add(loop, control_lost_fd(&obj->control), lost, obj))) {
+		ERROR("control thread failed to start on display %s\n", obj->name);
+		obj->active = True;
+		seat_close(obj, loop);
+		return False;
+	}
+	/* without a thread, rediscovery runs from the event loop */
+	if (control_retry_fd(&obj->control) >= 0 &&
+			!loop_add(loop, control_retry_fd(&obj->control), seat_retry, obj)) {
+		obj->active = True;
+		seat_close(obj, loop);
+		return False;
+	}
+
+	if (!listen_start(&obj->listen, &obj->control, loop)) {
+		ERROR("listener failed to start on display %s\n", obj->name);
+		obj->active = True;
+		seat_close(obj, loop);
+		return False;
+	}
+	obj->active = True;
+	return True;
+}
+
+Seat* seat_find(Seat* seats, int count, Display* display) {
+	int i;
+	for (i = 0; i < count; i++) {
+		if (seats[i].display != NULL &&
+				(seats[i].display == display || seats[i].control_display == display))
+			return &seats[i];
+	}
+	return NULL;
+}
+
+void seat_error(Seat* obj) {
+	uint64_t one = 1;
+	if (obj->error_fd < 0 || write(obj->error_fd, &one, sizeof(one)) != sizeof(one))
+		ERROR("failed to report an error on display %s\n", obj->name);
+}
+
+void seat_dump(Seat* obj, FILE* out) {
+	fprintf(out, "[S] display %s: %d devices\n", obj->name, obj->control.device_count);
+	control_dump(&obj->control, out);
+}
+
+void seat_close(Seat* obj, Loop* loop) {
+	if (!obj->active)
+		return;
+	listen_stop(&obj->listen, loop);
+	listen_free(&obj->listen);
+	seat_unwatch(obj, loop);
+	control_free(&obj->control);
+	seat_close_control(obj);
+	XCloseDisplay(obj->display);
+	obj->display = NULL;
+	free(obj->name);
+	obj->active = False;
+}
+
+void seat_lost(Seat* obj, Loop* loop) {
+	if (!obj->active)
+		return;
+	listen_stop(&obj->listen, loop);
+	listen_free(&obj->listen);
+	seat_unwatch(obj, loop);
+	control_discard(&obj->control);
+
+	/* Xlib stops talking to a connection once it has seen an I/O error on
+	 * it, so closing the display only releases its memory and socket. The
+	 * other connection of the seat is dropped along with it. */
+	seat_close_control(obj);
+	XCloseDisplay(obj->display);
+	obj->display = NULL;
+	free(obj->name);
+	obj->active = False;
+}
@@ -0,0 +1,431 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#define _GNU_SOURCE
+#include "server.h"
+#include "common.h"
+#include "stats.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* Make room for size more bytes of output, growing the buffer as needed so
+ * a long reply is never cut short. Returns False if out of memory, after
+ * which the client is dropped on the next flush.
+ */
+static Bool server_reserve(ServerClient* client, size_t size) {
+	size_t want = client->output_len + size;
+	size_t grow = client->output_size > 0 ? client->output_size : MTRACKD_SERVER_OUTPUT_SIZE;
+	char* output;
+
+	if (client->overflow)
+		return False;
+	if (want <= (size_t)client->output_size)
+		return True;
+	while (grow < want)
+		grow *= 2;
+	if (grow > INT_MAX || (output = realloc(client->output, grow)) == NULL) {
+		client->overflow = True;
+		return False;
+	}
+	client->output = output;
+	client->output_size = grow;
+	return True;
+}
+
+static void server_printf(ServerClient* client, const char* format, ...) {
+	int len;
+	va_list args;
+
+	va_start(args, format);
+	len = vsnprintf(NULL, 0, format, args);
+	va_end(args);
+	if (len < 0 || !server_reserve(client, len + 1))
+		return;
+
+	va_start(args, format);
+	vsnprintf(client->output + client->output_len, len + 1, format, args);
+	va_end(args);
+	client->output_len += len;
+}
+
+/* Copy everything written to a stream into the client output.
+ */
+static void server_write_stream(ServerClient* client, char* buf, size_t size) {
+	if (buf == NULL)
+		return;
+	if (server_reserve(client, size)) {
+		memcpy(client->output + client->output_len, buf, size);
+		client->output_len += size;
+	}
+	free(buf);
+}
+
+static void server_close_client(ServerClient* client) {
+	loop_remove(client->server->loop, client->fd);
+	close(client->fd);
+	client->fd = -1;
+	free(client->output);
+	client->output = NULL;
+	client->output_size = 0;
+	DEBUG("control client disconnected\n");
+}
+
+/* Write as much pending output as the socket takes without blocking. Output
+ * which does not fit waits in the buffer, but a client which leaves more than
+ * MTRACKD_SERVER_OUTPUT_SIZE bytes unread for MTRACKD_SERVER_STALLS wakeups in
+ * a row is dropped rather than allowed to grow it without bound.
+ */
+static void server_flush(ServerClient* client) {
+	ssize_t len;
+	int pending = client->output_len;
+
+	if (client->overflow) {
+		WARN("out of memory for control client replies, dropping it\n");
+		server_close_client(client);
+		return;
+	}
+
+	while (client->output_len > 0) {
+		len = send(client->fd, client->output, client->output_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			if (errno == EINTR)
+				continue;
+			server_close_client(client);
+			return;
+		}
+		client->output_len -= len;
+		memmove(client->output, client->output + len, client->output_len);
+	}
+
+	if (client->output_len <= MTRACKD_SERVER_OUTPUT_SIZE || client->output_len < pending)
+		client->stalls = 0;
+	else if (++client->stalls >= MTRACKD_SERVER_STALLS) {
+		WARN("control client is not reading its replies, dropping it\n");
+		server_close_client(client);
+		return;
+	}
+
+	loop_set_events(client->server->loop, client->fd,
+		client->output_len > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+static const char* server_backend_name(Listen* listen) {
+	switch (listen->backend) {
+	case MTRACKD_BACKEND_XINPUT2:
+		return "xinput2";
+	case MTRACKD_BACKEND_EVDEV:
+		return "evdev";
+	default:
+		return "poll";
+	}
+}
+
+static void server_seat_status(Seat* seat, ServerClient* client) {
+	Listen* listen = &seat->listen;
+	Engine* engine = &listen->engine;
+	const char* state = engine->paused ? "paused" : engine->enabled ? "enabled" : "disabled";
+
+	server_printf(client, "display %s\n", seat->name);
+	server_printf(client, "state %s\n", state);
+	server_printf(client, "backend %s\n", server_backend_name(listen));
+	server_printf(client, "delay %d\n", (int)(engine->delay * 1000.0 + 0.5));
+	server_printf(client, "adaptive %d\n", engine->adaptive);
+	server_printf(client, "activedelay %d\n", (int)(engine->idle_time * 1000.0 + 0.5));
+	server_printf(client, "poll %d\n", listen->poll_time / 1000);
+	server_printf(client, "pollmax %d\n", listen->poll_max / 1000);
+	server_printf(client, "pollbattery %d\n", listen->poll_battery / 1000);
+	server_printf(client, "modifiers %s\n", engine->modifiers ? "on" : "off");
+	server_printf(client, "holddisabled %d\n", (int)(engine->hold_disabled * 1000.0 + 0.5));
+	server_printf(client, "holdenabled %d\n", (int)(engine->hold_enabled * 1000.0 + 0.5));
+	server_printf(client, "armkeys %d\n", engine->arm_keys);
+	server_printf(client, "armwindow %d\n", (int)(engine->arm_window * 1000.0 + 0.5));
+	server_printf(client, "devices %d\n", seat->control.device_count);
+	server_printf(client, "toggles %lu\n", control_toggles(&seat->control));
+}
+
+static void server_status(Server* obj, ServerClient* client) {
+	int i;
+	for (i = 0; i < obj->seat_count; i++) {
+		if (obj->seats[i].active)
+			server_seat_status(&obj->seats[i], client);
+	}
+}
+
+static void server_stats(Server* obj, ServerClient* client) {
+	int i;
+	char* buf = NULL;
+	size_t size = 0;
+	FILE* out = open_memstream(&buf, &size);
+
+	if (out == NULL) {
+		server_printf(client, "error out of memory\n");
+		return;
+	}
+	stats_dump(&stats, out, obj->loop->wakeups);
+	for (i = 0; i < obj->seat_count; i++) {
+		if (obj->seats[i].active)
+			seat_dump(&obj->seats[i], out);
+	}
+	fclose(out);
+	server_write_stream(client, buf, size);
+}
+
+/* Handle "set <name> <value>" for one seat. Returns False if the arguments
+ * are invalid.
+ */
+static Bool server_set(Seat* seat, char* name, char* value) {
+	Listen* listen = &seat->listen;
+	Bool modifiers = listen->engine.modifiers;
+	int delay = (int)(listen->engine.delay * 1000.0 + 0.5);
+	int poll = listen->poll_time / 1000;
+	int poll_max = listen->poll_max / 1000;
+	int poll_battery = listen->poll_battery / 1000;
+	int number;
+
+	if (name == NULL || value == NULL)
+		return False;
+
+	if (strcmp(name, "modifiers") == 0) {
+		if (strcmp(value, "on") == 0)
+			modifiers = True;
+		else if (strcmp(value, "off") == 0)
+			modifiers = False;
+		else
+			return False;
+	}
+	else {
+		number = atoi(value);
+		if (strcmp(name, "delay") == 0 && number > 0)
+			delay = number;
+		else if (strcmp(name, "poll") == 0 && number > 0)
+			poll = number;
+		else if (strcmp(name, "pollmax") == 0 && number >= 0)
+			poll_max = number;
+		else if (strcmp(name, "pollbattery") == 0 && number >= 0)
+			poll_battery = number;
+		else
+			return False;
+	}
+
+	listen_configure(listen, modifiers, delay, poll, poll_max, poll_battery);
+	INFO("%s set to %s on display %s by control client\n", name, value, seat->name);
+	return True;
+}
+
+static void server_command(Server* obj, ServerClient* client, char* line) {
+	int i;
+	Seat* seat;
+	char* save = NULL;
+	char* cmd = strtok_r(line, " \t\r", &save);
+	char* arg1 = strtok_r(NULL, " \t\r", &save);
+	char* arg2 = strtok_r(NULL, " \t\r", &save);
+
+	if (cmd == NULL)
+		return;
+
+	DEBUG("control command: %s\n", cmd);
+	if (strcmp(cmd, "status") == 0)
+		server_status(obj, client);
+	else if (strcmp(cmd, "stats") == 0)
+		server_stats(obj, client);
+	else if (strcmp(cmd, "set") == 0 || strcmp(cmd, "pause") == 0 ||
+			strcmp(cmd, "resume") == 0 || strcmp(cmd, "rescan") == 0) {
+		for (i = 0; i < obj->seat_count; i++) {
+			seat = &obj->seats[i];
+			if (!seat->active)
+				continue;
+			if (strcmp(cmd, "pause") == 0)
+				listen_pause(&seat->listen, True);
+			else if (strcmp(cmd, "resume") == 0)
+				listen_pause(&seat->listen, False);
+			else if (strcmp(cmd, "rescan") == 0)
+				control_rescan(&seat->control);
+			else if (!server_set(seat, arg1, arg2)) {
+				server_printf(client, "error usage: set delay|poll|pollmax|pollbattery MS, set modifiers on|off\n");
+				return;
+			}
+		}
+	}
+	else if (strcmp(cmd, "help") == 0)
+		server_printf(client, "commands: status, stats, set NAME VALUE, pause, resume, rescan, help\n");
+	else {
+		server_printf(client, "error unknown command: %s\n", cmd);
+		return;
+	}
+	server_printf(client, "ok\n");
+}
+
+static void server_read(ServerClient* client) {
+	ssize_t len;
+	char* start;
+	char* end;
+
+	while (True) {
+		len = recv(client->fd, client->input + client->input_len,
+			MTRACKD_SERVER_INPUT_SIZE - client->input_len - 1, MSG_DONTWAIT);
+		if (len == 0 || (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			server_close_client(client);
+			return;
+		}
+		if (len < 0)
+			break;
+
+		client->input_len += len;
+		client->input[client->input_len] = '\0';
+
+		start = client->input;
+		while ((end = strchr(start, '\n')) != NULL) {
+			*end = '\0';
+			server_command(client->server, client, start);
+			start = end + 1;
+		}
+		client->input_len -= start - client->input;
+		memmove(client->input, start, client->input_len);
+
+		if (client->input_len == MTRACKD_SERVER_INPUT_SIZE - 1) {
+			WARN("control command too long, dropping client\n");
+			server_close_client(client);
+			return;
+		}
+	}
+	server_flush(client);
+}
+
+static void server_client_handler(void* data, uint32_t events) {
+	ServerClient* client = data;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		server_close_client(client);
+		return;
+	}
+	if (events & EPOLLIN)
+		server_read(client);
+	if (client->fd != -1 && events & EPOLLOUT)
+		server_flush(client);
+}
+
+static void server_accept_handler(void* data, uint32_t events) {
+	int i, fd;
+	Server* obj = data;
+
+	while ((fd = accept4(obj->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		for (i = 0; i < MTRACKD_SERVER_MAX_CLIENTS; i++) {
+			if (obj->clients[i].fd == -1)
+				break;
+		}
+		if (i == MTRACKD_SERVER_MAX_CLIENTS) {
+			WARN("too many control clients\n");
+			close(fd);
+			continue;
+		}
+
+		obj->clients[i].fd = fd;
+		obj->clients[i].input_len = 0;
+		obj->clients[i].output_len = 0;
+		obj->clients[i].stalls = 0;
+		obj->clients[i].overflow = False;
+		if (!loop_add(obj->loop, fd, server_client_handler, &obj->clients[i])) {
+			close(fd);
+			obj->clients[i].fd = -1;
+			continue;
+		}
+		DEBUG("control client connected\n");
+	}
+}
+
+Bool server_init(Server* obj, char* path, Loop* loop, Seat* seats, int seat_count) {
+	int i;
+	Bool bound;
+	mode_t mask;
+	struct sockaddr_un addr;
+
+	obj->path = NULL;
+	obj->fd = -1;
+	obj->loop = loop;
+	obj->seats = seats;
+	obj->seat_count = seat_count;
+	for (i = 0; i < MTRACKD_SERVER_MAX_CLIENTS; i++) {
+		obj->clients[i].fd = -1;
+		obj->clients[i].server = obj;
+		obj->clients[i].output = NULL;
+		obj->clients[i].output_size = 0;
+	}
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		ERROR("socket path is too long: %s\n", path);
+		return False;
+	}
+
+	obj->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (obj->fd < 0) {
+		ERROR("could not create socket: %s\n", strerror(errno));
+		return False;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	/* create the socket owner-only so nobody else can connect in between */
+	mask = umask(S_IRWXG | S_IRWXO | S_IXUSR);
+	bound = bind(obj->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+	umask(mask);
+	if (!bound || listen(obj->fd, MTRACKD_SERVER_MAX_CLIENTS) != 0) {
+		ERROR("could not listen on %s: %s\n", path, strerror(errno));
+		server_free(obj);
+		return False;
+	}
+	obj->path = strdup(path);
+
+	if (!loop_add(loop, obj->fd, server_accept_handler, obj)) {
+		server_free(obj);
+		return False;
+	}
+	return True;
+}
+
+void server_free(Server* obj) {
+	int i;
+	for (i = 0; i < MTRACKD_SERVER_MAX_CLIENTS; i++) {
+		if (obj->clients[i].fd != -1)
+			server_close_client(&obj->clients[i]);
+	}
+	if (obj->fd >= 0) {
+		loop_remove(obj->loop, obj->fd);
+		close(obj->fd);
+		obj->fd = -1;
+	}
+	if (obj->path != NULL) {
+		unlink(obj->path);
+		free(obj->path);
+		obj->path = NULL;
+	}
+}
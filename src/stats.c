@@ -0,0 +1,200 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "stats.h"
+#include "common.h"
+#include <string.h>
+#include <sys/resource.h>
+
+static void stats_hist_init(Histogram* hist, const char* name) {
+	memset(hist, 0, sizeof(Histogram));
+	hist->name = name;
+}
+
+static void stats_requests_init(Requests* req, const char* name) {
+	memset(req, 0, sizeof(Requests));
+	req->name = name;
+}
+
+void stats_init(Stats* obj) {
+	obj->start = now();
+	obj->wanted = 0;
+	obj->changed = 0;
+	stats_hist_init(&obj->detect, "detect");
+	stats_hist_init(&obj->enable, "enable");
+	stats_hist_init(&obj->get, "get");
+	stats_hist_init(&obj->set, "set");
+	stats_hist_init(&obj->apply, "apply");
+	stats_requests_init(&obj->tick, "tick");
+	stats_requests_init(&obj->toggle, "toggle");
+}
+
+/* Add to a double shared between threads.
+ */
+static void stats_add(double* value, double add) {
+	double old, next;
+
+	__atomic_load(value, &old, __ATOMIC_RELAXED);
+	do {
+		next = old + add;
+	} while (!__atomic_compare_exchange(value, &old, &next, True, __ATOMIC_RELAXED,
+		__ATOMIC_RELAXED));
+}
+
+/* Raise a double shared between threads to at least the given value.
+ */
+static void stats_raise(double* value, double next) {
+	double old;
+
+	__atomic_load(value, &old, __ATOMIC_RELAXED);
+	while (next > old && !__atomic_compare_exchange(value, &old, &next, True,
+		__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void stats_record(Histogram* hist, double seconds) {
+	int bucket = 0;
+	unsigned long us;
+
+	if (seconds < 0)
+		seconds = 0;
+	us = (unsigned long)(seconds * 1000000.0);
+	while (us > 0 && bucket < MTRACKD_STATS_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	__atomic_add_fetch(&hist->buckets[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+	stats_add(&hist->sum, seconds);
+	stats_raise(&hist->max, seconds);
+}
+
+Bool stats_requests(Requests* req, unsigned long requests, unsigned long round_trips) {
+	unsigned long max = __atomic_load_n(&req->max, __ATOMIC_RELAXED);
+	Bool worst = False;
+
+	__atomic_add_fetch(&req->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&req->requests, requests, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&req->round_trips, round_trips, __ATOMIC_RELAXED);
+	while (requests > max && !(worst = __atomic_compare_exchange_n(&req->max, &max, requests,
+		True, __ATOMIC_RELAXED, __ATOMIC_RELAXED)));
+	if (req->budget == 0 || requests <= req->budget)
+		return True;
+	return !(__atomic_add_fetch(&req->over, 1, __ATOMIC_RELAXED) == 1 || worst);
+}
+
+double stats_percentile(Histogram* hist, double percentile) {
+	int i;
+	unsigned long seen = 0;
+	unsigned long target = (unsigned long)(hist->count * percentile / 100.0);
+
+	if (hist->count == 0)
+		return 0;
+	for (i = 0; i < MTRACKD_STATS_BUCKETS - 1; i++) {
+		seen += hist->buckets[i];
+		if (seen > target)
+			return (1UL << i) / 1000000.0;
+	}
+	return hist->max;
+}
+
+static void stats_hist_dump(Histogram* hist, FILE* out) {
+	int i;
+	double mean = hist->count > 0 ? hist->sum / hist->count : 0;
+
+	fprintf(out, "[S] %s: count %lu, mean %.3f ms, p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, "
+		"max %.3f ms\n", hist->name, hist->count, mean * 1000.0,
+		stats_percentile(hist, 50) * 1000.0, stats_percentile(hist, 99) * 1000.0,
+		stats_percentile(hist, 99.9) * 1000.0, hist->max * 1000.0);
+	for (i = 0; i < MTRACKD_STATS_BUCKETS; i++) {
+		if (hist->buckets[i] == 0)
+			continue;
+		if (i < MTRACKD_STATS_BUCKETS - 1)
+			fprintf(out, "[S]   < %8lu us: %lu\n", 1UL << i, hist->buckets[i]);
+		else
+			fprintf(out, "[S]  >= %8lu us: %lu\n", 1UL << (i - 1), hist->buckets[i]);
+	}
+}
+
+static void stats_requests_dump(Requests* req, FILE* out) {
+	fprintf(out, "[S] %s requests: count %lu, mean %.2f, max %lu, round trips %.2f, "
+		"budget %lu, over %lu\n", req->name, req->count,
+		req->count > 0 ? (double)req->requests / req->count : 0, req->max,
+		req->count > 0 ? (double)req->round_trips / req->count : 0, req->budget, req->over);
+}
+
+double stats_cpu_time() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+}
+
+void stats_dump(Stats* obj, FILE* out, unsigned long wakeups) {
+	double uptime = now() - obj->start;
+
+	fprintf(out, "[S] uptime %.1f s, cpu %.3f s, %lu wakeups, %.2f wakeups/min\n",
+		uptime, stats_cpu_time(), wakeups, uptime > 0 ? wakeups * 60.0 / uptime : 0);
+	fprintf(out, "[S] state changes: %lu made, %lu wanted, %lu held back\n", obj->changed,
+		obj->wanted, obj->wanted > obj->changed ? obj->wanted - obj->changed : 0);
+	stats_hist_dump(&obj->detect, out);
+	stats_hist_dump(&obj->enable, out);
+	stats_hist_dump(&obj->get, out);
+	stats_hist_dump(&obj->set, out);
+	stats_hist_dump(&obj->apply, out);
+	stats_requests_dump(&obj->tick, out);
+	stats_requests_dump(&obj->toggle, out);
+}
+
+static void stats_hist_write(Histogram* hist, FILE* out) {
+	int i;
+	fprintf(out, "\"%s\": {\"count\": %lu, \"mean\": %.9f, \"p50\": %.9f, "
+		"\"p99\": %.9f, \"p999\": %.9f, \"max\": %.9f, \"buckets\": [", hist->name,
+		hist->count, hist->count > 0 ? hist->sum / hist->count : 0, stats_percentile(hist, 50),
+		stats_percentile(hist, 99), stats_percentile(hist, 99.9), hist->max);
+	for (i = 0; i < MTRACKD_STATS_BUCKETS; i++)
+		fprintf(out, i > 0 ? ", %lu" : "%lu", hist->buckets[i]);
+	fprintf(out, "]}");
+}
+
+static void stats_requests_write(Requests* req, FILE* out) {
+	fprintf(out, "\"%s_requests\": {\"count\": %lu, \"requests\": %lu, \"round_trips\": %lu, "
+		"\"max\": %lu, \"budget\": %lu, \"over\": %lu}", req->name, req->count, req->requests,
+		req->round_trips, req->max, req->budget, req->over);
+}
+
+void stats_write(Stats* obj, FILE* out) {
+	fprintf(out, "\"changed\": %lu, \"wanted\": %lu, ", obj->changed, obj->wanted);
+	stats_hist_write(&obj->detect, out);
+	fprintf(out, ", ");
+	stats_hist_write(&obj->enable, out);
+	fprintf(out, ", ");
+	stats_hist_write(&obj->get, out);
+	fprintf(out, ", ");
+	stats_hist_write(&obj->set, out);
+	fprintf(out, ", ");
+	stats_hist_write(&obj->apply, out);
+	fprintf(out, ", ");
+	stats_requests_write(&obj->tick, out);
+	fprintf(out, ", ");
+	stats_requests_write(&obj->toggle, out);
+}
@@ -0,0 +1,118 @@
+/***************************************************************************
+ *
+ * dispad - Disable trackpads on keyboard events.
+ * Copyright (C) 2011 Ryan Bourgeois <bluedragonx@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ **************************************************************************/
+
+#include "trace.h"
+#include "common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+void trace_init(Trace* obj) {
+	obj->fd = -1;
+	obj->header = NULL;
+	obj->records = NULL;
+	obj->size = 0;
+}
+
+static int trace_valid(TraceHeader* header, size_t size) {
+	return size >= sizeof(TraceHeader) && header->magic == MTRACKD_TRACE_MAGIC &&
+		header->version == MTRACKD_TRACE_VERSION &&
+		header->record_size == sizeof(TraceRecord) && header->capacity > 0 &&
+		size == sizeof(TraceHeader) + (size_t)header->capacity * sizeof(TraceRecord);
+}
+
+int trace_open(Trace* obj, const char* path, uint32_t capacity) {
+	struct stat st;
+	void* map;
+	int res = 0;
+	int writable = capacity > 0;
+	size_t size = sizeof(TraceHeader) + (size_t)capacity * sizeof(TraceRecord);
+
+	trace_init(obj);
+	obj->fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0600);
+	if (obj->fd < 0 || fstat(obj->fd, &st) != 0) {
+		ERROR("could not open trace file %s: %s\n", path, strerror(errno));
+		trace_close(obj);
+		return 0;
+	}
+
+	/* allocate the blocks up front rather than leaving a sparse file, so a
+	 * full disk is reported here instead of as SIGBUS while recording */
+	if (!writable)
+		size = st.st_size;
+	else if ((size_t)st.st_size > size && ftruncate(obj->fd, size) != 0)
+		res = errno;
+	else
+		res = posix_fallocate(obj->fd, 0, size);
+	if (res != 0) {
+		ERROR("could not size trace file %s: %s\n", path, strerror(res));
+		trace_close(obj);
+		return 0;
+	}
+
+	/* the mapping is faulted in up front, so recording only ever touches memory */
+	map = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+		MAP_SHARED | MAP_POPULATE, obj->fd, 0);
+	if (map == MAP_FAILED) {
+		ERROR("could not map trace file %s: %s\n", path, strerror(errno));
+		trace_close(obj);
+		return 0;
+	}
+	obj->header = map;
+	obj->records = (TraceRecord*)(obj->header + 1);
+	obj->size = size;
+
+	if (writable && (!trace_valid(obj->header, size) || obj->header->capacity != capacity)) {
+		memset(obj->header, 0, sizeof(TraceHeader));
+		obj->header->magic = MTRACKD_TRACE_MAGIC;
+		obj->header->version = MTRACKD_TRACE_VERSION;
+		obj->header->capacity = capacity;
+		obj->header->record_size = sizeof(TraceRecord);
+	}
+	else if (!writable && !trace_valid(obj->header, size)) {
+		ERROR("not a dispad trace file: %s\n", path);
+		trace_close(obj);
+		return 0;
+	}
+	return 1;
+}
+
+uint64_t trace_count(Trace* obj, uint64_t* first) {
+	uint64_t head = obj->header->head;
+	uint64_t count = head < obj->header->capacity ? head : obj->header->capacity;
+	*first = head - count;
+	return count;
+}
+
+TraceRecord* trace_get(Trace* obj, uint64_t index) {
+	return &obj->records[index % obj->header->capacity];
+}
+
+void trace_close(Trace* obj) {
+	if (obj->header != NULL)
+		munmap(obj->header, obj->size);
+	if (obj->fd >= 0)
+		close(obj->fd);
+	trace_init(obj);
+}